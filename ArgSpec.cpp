@@ -16,37 +16,311 @@
 
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <locale.h>
+#include <ctype.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#if AS_INSTRUMENT
+    #include <chrono>
+#endif
+
+#ifdef _WIN32
+    #include <stdio.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+#ifdef _WIN32
+    #define AS_ENVIRON _environ
+#else
+    extern char** environ;
+    #define AS_ENVIRON environ
+#endif
 
 #ifdef _MSC_VER
+    #include <intrin.h>
     #define strcasecmp _stricmp
     #define strncasecmp _strnicmp
 #endif
 
+#if defined(_MSC_VER)
+    #define AS_FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+    #define AS_FORCE_INLINE inline __attribute__((always_inline))
+#else
+    #define AS_FORCE_INLINE inline
+#endif
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define AS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define AS_SSE2
+#endif
+
 #define AS_MD_USE_DD     // Use <dd> tags for indentation, looks better with github-flavoured markdown
 
 namespace AS
 {
 
+////////////////////////////////////////////////////////////////////////////////
+// Allocation
+//
+
+namespace
+{
+    thread_local cArgAllocator* tCurrentAllocator = nullptr;
+
+    class cAllocScope
+    // Makes 'allocator' the default for internal containers created on this thread, until destroyed.
+    {
+    public:
+        explicit cAllocScope(cArgAllocator* allocator) : mPrevious(tCurrentAllocator) { tCurrentAllocator = allocator; }
+        ~cAllocScope() { tCurrentAllocator = mPrevious; }
+
+        cAllocScope(const cAllocScope&) = delete;
+        cAllocScope& operator=(const cAllocScope&) = delete;
+
+    protected:
+        cArgAllocator* mPrevious;
+    };
+
+    const size_t kArenaAlign = alignof(max_align_t);
+
+    inline size_t ArenaAlign(size_t size)
+    {
+        return (size + kArenaAlign - 1) & ~(kArenaAlign - 1);
+    }
+}
+
+void* ArgAllocate(cArgAllocator* allocator, size_t size)
+{
+    if (!allocator)
+        return ::operator new(size);
+
+    void* p = allocator->Allocate(size);
+
+    if (!p)
+    {
+    #if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+        throw std::bad_alloc();
+    #else
+        abort();
+    #endif
+    }
+
+    return p;
+}
+
+void ArgFree(cArgAllocator* allocator, void* p, size_t size)
+{
+    if (allocator)
+        allocator->Free(p, size);
+    else
+        ::operator delete(p);
+}
+
+cArgAllocator* CurrentArgAllocator()
+{
+    return tCurrentAllocator;
+}
+
+template<class T, class... T_ARGS> T* NewArg(cArgAllocator* allocator, T_ARGS&&... args)
+// Equivalent of new T(args) via the given allocator
+{
+    return new(ArgAllocate(allocator, sizeof(T))) T(std::forward<T_ARGS>(args)...);
+}
+
+template<class T> void DeleteArg(cArgAllocator* allocator, T* p)
+{
+    if (p)
+    {
+        p->~T();
+        ArgFree(allocator, p, sizeof(T));
+    }
+}
+
+struct cArgDeleter
+/// For std::unique_ptr of objects created via NewArg()
+{
+    cArgAllocator* mAllocator;
+
+    template<class T> void operator()(T* p) const { DeleteArg(mAllocator, p); }
+};
+
+
+// cArgArena
+struct cArgArena::cBlock
+{
+    cBlock* mNext;
+    size_t  mSize;      // including this header
+};
+
+cArgArena::cArgArena(void* buffer, size_t capacity)
+{
+    uintptr_t start = (uintptr_t(buffer) + kArenaAlign - 1) & ~uintptr_t(kArenaAlign - 1);
+    uintptr_t end   = uintptr_t(buffer) + capacity;
+
+    mBuffer   = static_cast<char*>(buffer);
+    mCursor   = reinterpret_cast<char*>(start);
+    mEnd      = reinterpret_cast<char*>(start < end ? end : start);
+    mCapacity = size_t(mEnd - mCursor);
+}
+
+cArgArena::cArgArena(size_t blockSize, cArgAllocator* parent) :
+    mParent(parent),
+    mBlockSize(blockSize)
+{
+}
+
+cArgArena::~cArgArena()
+{
+    Reset();
+}
+
+void* cArgArena::Allocate(size_t size)
+{
+    size = ArenaAlign(size ? size : 1);
+
+    if (size > size_t(mEnd - mCursor))
+    {
+        if (mBuffer)
+            return nullptr;     // fixed capacity
+
+        // Start a new block. Whatever's left of the current one is abandoned.
+        size_t headerSize = ArenaAlign(sizeof(cBlock));
+        size_t blockSize = std::max(mBlockSize, headerSize + size);
+        cBlock* block = static_cast<cBlock*>(mParent ? mParent->Allocate(blockSize) : malloc(blockSize));
+
+        if (!block)
+            return nullptr;
+
+        block->mNext = mBlocks;
+        block->mSize = blockSize;
+        mBlocks = block;
+
+        mCursor = reinterpret_cast<char*>(block) + headerSize;
+        mEnd    = reinterpret_cast<char*>(block) + blockSize;
+        mCapacity += blockSize - headerSize;
+    }
+
+    void* result = mCursor;
+    mCursor += size;
+    mUsed += size;
+
+    if (mPeak < mUsed)
+        mPeak = mUsed;
+
+    return result;
+}
+
+void cArgArena::Free(void* p, size_t size)
+{
+    size = ArenaAlign(size ? size : 1);
+
+    // Reclaim the last allocation, which catches most temporaries.
+    if (static_cast<char*>(p) + size == mCursor)
+    {
+        mCursor = static_cast<char*>(p);
+        mUsed -= size;
+    }
+}
+
+void cArgArena::Reset()
+{
+    if (mBuffer)
+    {
+        mCursor = mEnd - mCapacity;
+        mUsed = 0;
+        return;
+    }
+
+    while (cBlock* block = mBlocks)
+    {
+        mBlocks = block->mNext;
+
+        if (mParent)
+            mParent->Free(block, block->mSize);
+        else
+            free(block);
+    }
+
+    mCursor   = nullptr;
+    mEnd      = nullptr;
+    mCapacity = 0;
+    mUsed     = 0;
+}
+
+size_t cArgArena::BytesUsed() const
+{
+    return mUsed;
+}
+
+size_t cArgArena::PeakBytesUsed() const
+{
+    return mPeak;
+}
+
+size_t cArgArena::Capacity() const
+{
+    return mCapacity;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Utilities
+//
+
 namespace
 {
     const char* const kEllipsisToken   = "...";
+    const char* const kDefaultSeparators = " \t";
 
     const char    kOpenBracketChar    = '[';
     const char    kCloseBracketChar   = ']';
     const char    kSetFlagChar        = '^';
     const char    kEnumSpecChar       = ':';
     const char    kEnumSpecInlineChar = '=';
+    const char    kEnumSpecFileChar   = '@';
     const char    kOptionChar         = '-';
+    const char    kEnvVarChar         = '$';
+    const char* const kCompleteOption  = "--complete";
     const char    kBeginArgChar       = '<';
     const char    kEndArgChar         = '>';
     const char    kArgSepChar         = ':';
     const char    kFormatChar         = '%';
+    const char    kResponseFileChar   = '@';
+
+    const int     kMaxResponseFileDepth = 32;
+    const size_t  kMaxResponseFiles     = 1024;         // total @file expansions per Parse()
+    const size_t  kMaxResponseFileArgs  = 1024 * 1024;  // no further files are expanded past this many arguments
 
     inline bool IsOption(const char* s)
     {
         return s[0] == kOptionChar && (isalpha(s[1]) || s[1] == kOptionChar);    // switch plus alpha character, to avoid picking up -10 etc.
     }
 
+    inline bool IsResponseFile(const char* s)
+    {
+        return s[0] == kResponseFileChar && s[1] != 0;
+    }
+
     inline bool Eq(const char* lhs, const char* rhs)
     {
         return strcasecmp(lhs, rhs) == 0;
@@ -57,1230 +331,5366 @@ namespace
         return strncasecmp(lhs, rhs, n) == 0;
     }
 
-    inline bool Eq(const string& lhs, const char* rhs)
+    inline bool Eq(const tArgString& lhs, const char* rhs)
     {
         return Eq(lhs.c_str(), rhs);
     }
 
-    void Sprintf(string* pStr, const char* format, ...)
+    inline unsigned FoldChar(char c)
+    // ASCII-only case folding, inline rather than a tolower() call per byte,
+    // as names are hashed for every option and config line parsed.
     {
-        static char buffer[1024];
-        va_list args;
-        va_start(args, format);
-        vsnprintf(buffer, 1024, format, args);
-        va_end(args);
-
-        (*pStr) = buffer;
+        unsigned u = (unsigned char) c;
+        return u - 'A' < 26u ? u + ('a' - 'A') : u;
     }
 
-    void SprintfAppend(string* pStr, const char* format, ...)
+    inline uint32_t FoldedHash(const char* s, size_t n)
+    // FNV-1a hash of the case-folded form of s[0..n), consistent with Eq().
     {
-        static char buffer[1024];
-        va_list args;
-        va_start(args, format);
-        vsnprintf(buffer, 1024, format, args);
-        va_end(args);
+        uint32_t hash = 2166136261u;
 
-        pStr->append(buffer);
+        for (size_t i = 0; i < n; i++)
+        {
+            hash ^= uint32_t(FoldChar(s[i]));
+            hash *= 16777619u;
+        }
+
+        return hash;
     }
+}
 
-    void Split(const char* line, vector<const char*>* a, const char* separators = " \t", vector<char>* scratch = nullptr)
-    // Splits 'line' into an array of tokens 'a', where each token is separated
-    // by the characters in "sep" (default is white space).
+namespace Detail
+// Helpers held by value in cArgSpec::Internal and friends, kept out of the
+// anonymous namespace so those classes don't have fields of internal linkage.
+{
+    struct cNameTable
+    /// Open-addressing hash table from case-folded names to indices. Names
+    /// themselves live elsewhere: Find() is given a predicate to confirm a
+    /// candidate index once its hash matches.
     {
-        static vector<char> sBuffer;
-        if (!scratch)
-            scratch = &sBuffer;
-
-        const char* s = line;
-
-        scratch->clear();
-        size_t len = strlen(line);
-        scratch->insert(scratch->begin(), s, s + len + 1);
+        struct cSlot
+        {
+            uint32_t mHash;
+            int      mIndex;    // -1 if empty
+        };
 
-        a->clear();
+        tArgVector<cSlot> mSlots;   // size is zero or a power of two
+        int           mCount = 0;
 
-        s = strtok(scratch->data(), separators);
-        if (!s)
-            return;
+        void Clear()
+        {
+            mSlots.clear();
+            mCount = 0;
+        }
 
-        a->push_back(s);
+        void Reserve(int count)
+        // Size for 'count' entries up front, avoiding rehashing as they're inserted.
+        {
+            size_t size = 16;
 
-        while ((s = strtok(0, separators)))
-            a->push_back(s);
-    }
+            while (size < 2 * size_t(count))
+                size *= 2;
 
+            if (size > mSlots.size())
+            {
+                mSlots.assign(size, cSlot { 0, -1 });
+                mCount = 0;
+            }
+        }
 
-    string NextToken(string& str, const char* separators = " \t\n")
-    {
-        string result(str);
-        str = "";
+        template<class T_MATCH> int Find(uint32_t hash, T_MATCH match) const
+        {
+            if (mSlots.empty())
+                return -1;
 
-        if (!separators || strlen(separators) == 0)
-            return result;
+            size_t mask = mSlots.size() - 1;
 
-        size_t index = result.find_first_of(separators);
+            for (size_t i = hash & mask; mSlots[i].mIndex >= 0; i = (i + 1) & mask)
+                if (mSlots[i].mHash == hash && match(mSlots[i].mIndex))
+                    return mSlots[i].mIndex;
 
-        while (index == 0)
-        {
-            result.erase(0, 1);
-            index = result.find_first_of(separators);
+            return -1;
         }
 
-        if (index == string::npos)
-            return result;
-
-        str.assign(result, index + 1, string::npos); // for some reason default last argument doesn't exist under current STL?
-        result.assign(result, 0, index);
+        void Insert(uint32_t hash, int index)
+        {
+            if (2 * (mCount + 1) > int(mSlots.size()))
+                Grow();
 
-        return result;
-    }
+            size_t mask = mSlots.size() - 1;
+            size_t i = hash & mask;
 
+            while (mSlots[i].mIndex >= 0)
+                i = (i + 1) & mask;
 
-    // Numbers
-    inline tArgError ErrorGarbage(const char* arg, string* errorString)
-    {
-        Sprintf(errorString, "Garbage at end of number: '%s' ", arg);
-        return kArgErrorGarbage;
-    }
+            mSlots[i].mHash  = hash;
+            mSlots[i].mIndex = index;
+            mCount++;
+        }
 
-    tArgError Parse(int* location, const char* arg, string* errorString)
-    {
-        char* sEnd;
-        int result = (int) strtol(arg, &sEnd, 0);
+        void Grow()
+        {
+            tArgVector<cSlot> oldSlots(mSlots.size() < 8 ? 16 : 2 * mSlots.size(), cSlot { 0, -1 });
+            oldSlots.swap(mSlots);
+            mCount = 0;
 
-        if (sEnd[0] != 0)
-            return ErrorGarbage(arg, errorString);
+            for (const cSlot& slot : oldSlots)
+                if (slot.mIndex >= 0)
+                    Insert(slot.mHash, slot.mIndex);
+        }
+    };
+}
 
-        if (location)
-            *location = result;
+using namespace Detail;
 
-        return kArgNoError;
+namespace
+{
+    inline bool EnvNameEq(const char* a, const char* b, size_t n)
+    // Environment variable names are case sensitive, except on Windows.
+    {
+    #ifdef _WIN32
+        return Eq(a, b, n);
+    #else
+        return memcmp(a, b, n) == 0;
+    #endif
     }
 
-    tArgError Parse(bool* location, const char* arg, string* errorString)
+    struct cEnvIndex
+    /// Index of environ entries by name, for expanding ${VAR} references.
+    /// It's only built on first use, so most parses never pay for it.
     {
-        bool result;
+        char**      mEnviron;
+        cNameTable  mTable;
+        bool        mBuilt = false;
 
-        if (Eq(arg, "true"))
-            result = true;
-        else if (Eq(arg, "false"))
-            result = false;
-        else if (Eq(arg, "on"))
-            result = true;
-        else if (Eq(arg, "off"))
-            result = false;
-        else
+        explicit cEnvIndex(char** env) : mEnviron(env) {}
+
+        const char* Find(const char* name, size_t n)
+        // Returns the value of the given variable, or nullptr if it's not set.
         {
-            int i;
+            if (!mBuilt)
+            {
+                for (int i = 0; mEnviron[i]; i++)
+                {
+                    const char* eq = strchr(mEnviron[i], '=');
 
-            tArgError error = Parse(&i, arg, errorString);
-            if (error != kArgNoError)
-                return error;
+                    if (eq && Find(mEnviron[i], eq - mEnviron[i], FoldedHash(mEnviron[i], eq - mEnviron[i])) < 0)
+                        mTable.Insert(FoldedHash(mEnviron[i], eq - mEnviron[i]), i);   // first wins, as for getenv()
+                }
 
-            result = i != 0;
-        }
+                mBuilt = true;
+            }
 
-        if (location)
-            *location = result;
+            int i = Find(name, n, FoldedHash(name, n));
+            return i >= 0 ? mEnviron[i] + n + 1 : nullptr;
+        }
 
-        return kArgNoError;
-    }
+        int Find(const char* name, size_t n, uint32_t hash) const
+        {
+            return mTable.Find(hash, [&](int i) { return EnvNameEq(mEnviron[i], name, n) && mEnviron[i][n] == '='; });
+        }
+    };
 
-    tArgError Parse(float* location, const char* arg, string* errorString)
+    void ExpandEnvRefs(const char* s, cEnvIndex* index, tArgVector<char>* out)
+    // Sets 'out' to s with each ${VAR} replaced by VAR's value, or nothing if
+    // it isn't set. Substituted values aren't themselves expanded.
     {
-        char* sEnd;
-        float result = strtof(arg, &sEnd);
+        out->clear();
 
-        if (sEnd[0] != 0)
+        for (const char* ref; (ref = strstr(s, "${")) != nullptr; )
         {
-            Sprintf(errorString, "Garbage at end of number: '%s' ", arg);
-            return kArgErrorGarbage;
-        }
+            const char* close = strchr(ref + 2, '}');
 
-        if (location)
-            *location = result;
+            if (!close)
+                break;
 
-        return kArgNoError;
-    }
+            out->insert(out->end(), s, ref);
 
-    tArgError Parse(double* location, const char* arg, string* errorString)
-    {
-        char* sEnd;
-        float result = strtof(arg, &sEnd);
+            if (const char* value = index->Find(ref + 2, close - ref - 2))
+                out->insert(out->end(), value, value + strlen(value));
 
-        if (sEnd[0] != 0)
-        {
-            Sprintf(errorString, "Garbage at end of number: '%s' ", arg);
-            return kArgErrorGarbage;
+            s = close + 1;
         }
 
-        if (location)
-            *location = result;
-
-        return kArgNoError;
+        out->insert(out->end(), s, s + strlen(s) + 1);
     }
+}
 
-    tArgError Parse(int n, float v[], const char**& argv, const char** argvEnd, string* errorString)
+namespace Detail
+{
+    struct cSortedNames
+    /// Names sorted case-insensitively, so all those with a given prefix
+    /// form a contiguous range, found by binary search. Names themselves
+    /// live elsewhere, and needn't be NUL-terminated.
     {
-        int i = 0;
+        struct cEntry
+        {
+            const char* mName;
+            uint32_t    mLength;
+            int         mIndex;
+        };
 
-        for (i = 0; i < n && argv < argvEnd && !IsOption(*argv); i++)
+        tArgVector<cEntry> mEntries;
+
+        static int Compare(const char* a, size_t aLength, const char* b, size_t bLength)
         {
-            tArgError err = Parse(v + i, *argv++, errorString);
+            for (size_t i = 0, n = std::min(aLength, bLength); i < n; i++)
+                if (FoldChar(a[i]) != FoldChar(b[i]))
+                    return FoldChar(a[i]) < FoldChar(b[i]) ? -1 : 1;
 
-            if (err != kArgNoError)
-                return err;
+            return aLength < bLength ? -1 : aLength > bLength ? 1 : 0;
         }
 
-        if (i == 1)     // treat single arg as vecn(s)
-            for (int j = i; j < n; j++)
-                v[j] = v[0];
-        else            // otherwise zero-fill
-            for (int j = i; j < n; j++)
-                v[j] = 0.0f;
-
-        return kArgNoError;
-    }
+        void Add(const char* name, size_t length, int index)
+        {
+            mEntries.push_back(cEntry { name, uint32_t(length), index });
+        }
 
-    tArgError Parse(const char** location, const char* arg, string* )
-    {
-        if (location)
-            *location = arg;
-        return kArgNoError;
-    }
-    tArgError Parse(string* location, const char* arg, string* )
-    {
-        if (location)
-            *location = arg;
-        return kArgNoError;
-    }
+        void Sort()
+        {
+            std::sort(mEntries.begin(), mEntries.end(),
+                [](const cEntry& a, const cEntry& b) { return Compare(a.mName, a.mLength, b.mName, b.mLength) < 0; });
+        }
 
-    // Enums
-    struct cEnumSpec
-    {
-        cEnumSpec(const char* name, const cArgEnumInfo* enumInfo) :
-            mName(name),
-            mEnumInfo(enumInfo)
-        {}
+        template<class T_FUNC> void FindPrefix(const char* prefix, size_t n, T_FUNC func) const
+        // Calls func(entry) for each name starting with prefix[0..n), in order.
+        {
+            auto it = std::lower_bound(mEntries.begin(), mEntries.end(), prefix,
+                [n](const cEntry& entry, const char* p) { return Compare(entry.mName, entry.mLength, p, n) < 0; });
 
-        string               mName;
-        const cArgEnumInfo*  mEnumInfo;
-        vector<cArgEnumInfo> mEnumInfoStore;    // for inline enums
+            for ( ; it != mEntries.end() && it->mLength >= n && Compare(it->mName, n, prefix, n) == 0; ++it)
+                func(*it);
+        }
     };
 
-    tArgError Parse(int* location, const cEnumSpec& enumSpec, const char* arg, string* errorString)
+    struct cPrefixTrie
+    /// Trie over names, case-folded as for FoldedHash(), mapping each
+    /// prefix to the index of the only name starting with it, or kAmbiguous.
+    /// Nodes are kept in one array, with children linked as siblings, so
+    /// it's compact and can be added to incrementally. Callers are expected
+    /// to insert each distinct name only once.
     {
-        const cArgEnumInfo* parseInfo = enumSpec.mEnumInfo;
+        enum { kNotFound = -1, kAmbiguous = -2 };
 
-        while (parseInfo->mToken)
+        struct cNode
         {
-            if (Eq(arg, parseInfo->mToken))
-            {
-                if (location)
-                    *location = parseInfo->mValue;
-
-                return kArgNoError;
-            }
-            
-            parseInfo++;
-        }
-
-        Sprintf(errorString, "Unknown enum '%s' of type %s", arg, enumSpec.mName.c_str());
-        return kArgErrorBadEnum;
-    }
-
+            int  mIndex;        // unique name with this prefix, or kAmbiguous
+            int  mChild;        // first child, or 0
+            int  mSibling;      // next sibling, or 0
+            char mChar;         // last character of the prefix
+        };
 
-    // Doc helpers
-    void AddDocString(string* helpString, const char* leader, const string& docString)
-    {
-        size_t lastLF = 0;
-        size_t nextLF;
+        tArgVector<cNode> mNodes;   // mNodes[0] is the root, for the empty prefix
 
-        do
+        void Clear()
         {
-            nextLF = docString.find('\n', lastLF);
-            SprintfAppend(helpString, "%s%s\n", leader, docString.substr(lastLF, nextLF - lastLF).c_str());
-            lastLF = nextLF + 1;
+            mNodes.clear();
         }
-        while (nextLF != string::npos);
-    }
 
-    void AddEnumDocs(string* helpString, const char* leader, const vector<cEnumSpec>& enumSpecs, tHelpType helpType)
-    {
-        for (size_t i = 0, n = enumSpecs.size(); i < n; i++)
+        void Insert(const char* name, size_t length, int index)
         {
-            if (helpType == kHelpHTML)
-                SprintfAppend(helpString, "<p><b>%s</b></p><blockquote><i>", enumSpecs[i].mName.c_str());
-            else if (helpType == kHelpMarkdown)
-                SprintfAppend(helpString, "\n%s**%s**\n\n", leader, enumSpecs[i].mName.c_str());
-            else
-                SprintfAppend(helpString, "\n%s%s:\n", leader, enumSpecs[i].mName.c_str());
+            if (mNodes.empty())
+                mNodes.push_back(cNode { kNotFound, 0, 0, 0 });
 
-            const cArgEnumInfo* argEnum = enumSpecs[i].mEnumInfo;
+            int node = 0;
 
-            while (argEnum->mToken)
+            for (size_t i = 0; i < length; i++)
             {
-                if (helpType == kHelpHTML)
-                    SprintfAppend(helpString, "%s</br>\n", argEnum->mToken);
-                else if (helpType == kHelpMarkdown)
-                    SprintfAppend(helpString, "%s- %s\n", leader, argEnum->mToken);
-                else
-                    SprintfAppend(helpString, "%s   %s\n", leader, argEnum->mToken);
-                argEnum++;
-            }
+                char c = char(FoldChar(name[i]));
+                int child = mNodes[node].mChild;
 
-            if (helpType == kHelpHTML)
-                SprintfAppend(helpString, "</i></blockquote>");
+                while (child && mNodes[child].mChar != c)
+                    child = mNodes[child].mSibling;
+
+                if (!child)
+                {
+                    child = int(mNodes.size());
+                    mNodes.push_back(cNode { kNotFound, 0, mNodes[node].mChild, c });
+                    mNodes[node].mChild = child;
+                }
+
+                node = child;
+                mNodes[node].mIndex = (mNodes[node].mIndex == kNotFound) ? index : kAmbiguous;
+            }
         }
-    }
-}
 
+        int Find(const char* prefix, size_t length) const
+        // Returns the index of the only name starting with 'prefix', or kNotFound or kAmbiguous.
+        {
+            if (mNodes.empty() || length == 0)
+                return kNotFound;
 
-////////////////////////////////////////////////////////////////////////////////
-// cArgSpec::Internal declaration
-//
+            int node = 0;
 
-namespace
-{
-    // Declarations
-    enum tArgType : unsigned short
-    {
-        kTypeInvalid,
-        kTypeBool,
-        kTypeInt,
-        kTypeFloat,
-        kTypeDouble,
-        kTypeCString,    // char*
-        kTypeString,     // string
-        kTypeVec2,
-        kTypeVec3,
-        kTypeVec4,
-        kTypeEnumBegin,
-        kTypeEnumEnd = kTypeEnumBegin + 1024,   // 1024 different enums should be enough for anyone™
+            for (size_t i = 0; i < length; i++)
+            {
+                char c = char(FoldChar(prefix[i]));
+                int child = mNodes[node].mChild;
 
-        kNumTypes,
+                while (child && mNodes[child].mChar != c)
+                    child = mNodes[child].mSibling;
 
-        kTypeArraySplitFlag  = 0x4000,     // array type: expecting "a b c ..."
-        kTypeArrayListFlag   = 0x8000,     // array type, expecting to use remaining argument list (or until next option)
-        kTypeBaseMask        = 0x3FFF
-    };
-    inline tArgType operator | (tArgType a, tArgType b)
-    { return tArgType(int(a) | int(b)); }
+                if (!child)
+                    return kNotFound;
 
-    struct cArgInfo
-    {
-        tArgType     mType;        // type of argument
-        string       mName;        // name for argument (optional)
-        void*        mLocation;    // pointer to result
-        bool         mIsRequired;  // present iff the previous argument is.
-        int          mFlagToSet;   // if +ve, set this flag if we see this argument
+                node = child;
+            }
+
+            return mNodes[node].mIndex;
+        }
     };
+}
 
-    struct cArgsSpec
+namespace
+{
+    template<class T_STRING> void Sprintf(T_STRING* pStr, const char* format, ...)
     {
-        vector<cArgInfo> mArguments;     // Arguments
-        string           mDescription;   // What they do
-    };
+        char buffer[1024];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buffer, 1024, format, args);
+        va_end(args);
 
-    struct cOptionsSpec : public cArgsSpec
+        (*pStr) = buffer;
+    }
+
+    template<class T_STRING> void SprintfAppend(T_STRING* pStr, const char* format, ...)
     {
-        string           mName;          // Name of option (-mName)
-        int              mFlagToSet;     // if +ve, set this flag if we see this argument
-    };
+        char buffer[1024];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buffer, 1024, format, args);
+        va_end(args);
+
+        pStr->append(buffer);
+    }
 }
 
-struct cArgSpec::Internal
+namespace Detail
 {
-    string               mCommandName;
-    string               mCommandDescription;
-    cArgsSpec            mMainArgs;
-    vector<cOptionsSpec> mOptions;
-    vector<cEnumSpec>    mEnumSpecs;
-    uint32_t             mFlags = 0;
-    bool                 mHelpRequested = false;
-
-    mutable string       mErrorString;
-
-    // Utilities
-    tArgSpecError   ConstructSpec(const char* briefDescription, va_list args);
+    // Separator scanning
+    struct cSeparators
+    /// Set of characters separating the elements of split array arguments.
+    /// Up to kMaxSIMD of them can be matched a vector at a time, otherwise
+    /// we fall back to mIsSeparator.
+    {
+        enum { kMaxSIMD = 4 };
 
-    tArgError       Parse(int argc, const char** argv);
+        char    mChars[kMaxSIMD] = {};
+        int     mNumChars = 0;          // number of separators in mChars, or -1 if there are too many
+        bool    mIsSeparator[256] = {};
 
-    void            CreateHelpString(const char* commandName, string* pString, tHelpType helpType) const;
+        void Set(const char* separators)
+        {
+            memset(mIsSeparator, 0, sizeof(mIsSeparator));
+            mNumChars = 0;
 
-    tArgError       ParseArgument     (const cArgInfo& info, const char**& argv, const char** argvEnd);
-    tArgError       ParseArrayArgument(const cArgInfo& info, const char**& argv, const char** argvEnd);
+            for ( ; *separators; separators++)
+            {
+                unsigned char c = *separators;
 
-    tArgError       ParseOptionArgs(const vector<cArgInfo>& optArgs, const char**& argv, const char** argvEnd);
-    tArgError       ParseOption(const char**& argv, const char** argvEnd);
+                if (mIsSeparator[c])
+                    continue;
 
-    void            AddArgDocs(string* pString, const vector<cArgInfo>& args, tHelpType helpType) const;
-    void            FindNameAndTypeFromOption(const string& str, tArgType* type, string* name) const;
-    const char*     NameFromArgType(tArgType argType) const;
-    tArgType        ArgTypeFromName(const char* typeName) const;
-};
+                mIsSeparator[c] = true;
 
+                if (mNumChars >= 0 && mNumChars < kMaxSIMD)
+                    mChars[mNumChars++] = char(c);
+                else
+                    mNumChars = -1;
+            }
+        }
 
-////////////////////////////////////////////////////////////////////////////////
-// cArgSpec
-//
+        tArgString Chars() const
+        {
+            tArgString result;
 
-cArgSpec::cArgSpec() :
-    _(*(new Internal))
-{
-}
+            for (int c = 1; c < 256; c++)
+                if (mIsSeparator[c])
+                    result += char(c);
 
-cArgSpec::~cArgSpec()
-{
-    delete &_;
+            return result;
+        }
+    };
 }
 
-tArgSpecError cArgSpec::ConstructSpec(const char* briefDescription, ...)
+namespace
 {
-    va_list args;
-    va_start(args, briefDescription);
-
-    tArgSpecError err = _.ConstructSpec(briefDescription, args);
+    inline int CountTrailingZeros(uint64_t m)
+    {
+    #if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, m);
+        return int(index);
+    #elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, uint32_t(m)))
+            return int(index);
+        _BitScanForward(&index, uint32_t(m >> 32));
+        return int(index) + 32;
+    #else
+        return __builtin_ctzll(m);
+    #endif
+    }
 
-    va_end(args);
-    return err;
-}
+    struct cSplitScanner
+    /// Steps through the separator-delimited elements of a range in place.
+    /// Rather than searching for each separator in turn, which costs a call
+    /// or two per (typically short) element, we classify 64 characters at a
+    /// time into a bitmask, and derive element starts and ends from that.
+    {
+        const char*         mS;                 // next block to classify
+        const char*         mEnd;
+        const cSeparators&  mSeparators;
+
+        const char*         mBlock  = nullptr;  // current block
+        uint64_t            mStarts = 0;        // bit i set if an element starts at mBlock[i]
+        uint64_t            mEnds   = 0;        // bit i set if an element ends just before mBlock[i]
+        uint64_t            mPrevSeparator = 1; // whether the last character of the previous block was a separator
+
+        cSplitScanner(const char* s, const char* end, const cSeparators& separators) :
+            mS(s),
+            mEnd(end),
+            mSeparators(separators)
+        {}
 
-tArgError cArgSpec::Parse(int argc, const char** argv)
-{
-    return _.Parse(argc, argv);
-}
+        bool Next(const char** token, const char** tokenEnd)
+        {
+            while (!mStarts)
+                if (!NextBlock())
+                    return false;
 
-bool AS::cArgSpec::Flag(int flag) const
-{
-    AS_ASSERT(flag < int(sizeof(_.mFlags) * 8));
-    return (_.mFlags & (1 << flag)) != 0;
-}
+            *token = mBlock + CountTrailingZeros(mStarts);
+            mStarts &= mStarts - 1;
 
-void AS::cArgSpec::SetFlag(int flag)
-{
-    AS_ASSERT(flag < int(sizeof(_.mFlags) * 8));
-    _.mFlags |= 1 << flag;
-}
+            while (!mEnds)
+                if (!NextBlock())
+                {
+                    *tokenEnd = mEnd;
+                    return true;
+                }
 
-void cArgSpec::CreateHelpString(const char* commandName, string* pString, tHelpType helpType) const
-{
-    _.CreateHelpString(commandName, pString, helpType);
-}
+            int i = CountTrailingZeros(mEnds);
+            *tokenEnd = mBlock + i;
+            mEnds &= mEnds - 1;
 
-const char* cArgSpec::HelpString(const char* commandName, tHelpType helpType) const
-{
-    CreateHelpString(commandName, &_.mErrorString, helpType);
-    return _.mErrorString.c_str();
-}
+            return true;
+        }
 
-const char* AS::cArgSpec::ErrorString()
-{
-    return _.mErrorString.c_str();
-}
+        bool NextBlock()
+        {
+            if (mS >= mEnd)
+                return false;
 
+            uint64_t separators = (mEnd - mS >= 64) ? SeparatorMask(mS) : SeparatorMaskTail(mS, mEnd);
 
-////////////////////////////////////////////////////////////////////////////////
-// cArgSpec::Internal implementation
-//
+            mStarts = ~separators & ((separators << 1) | mPrevSeparator);
+            mEnds   =  separators & ~((separators << 1) | mPrevSeparator);
+            mPrevSeparator = separators >> 63;
 
-tArgSpecError cArgSpec::Internal::ConstructSpec(const char* description, va_list args)
-{
-    mCommandDescription = description;
-    mMainArgs.mDescription.clear();
-    mMainArgs.mArguments.clear();
-    mOptions.clear();
-    mEnumSpecs.clear();
-    mErrorString.clear();
+            mBlock = mS;
+            mS += 64;
+            return true;
+        }
 
-    tArgSpecError err = kSpecNoError;
+        uint64_t SeparatorMaskTail(const char* s, const char* end) const
+        // Characters past the end count as separators, so a final element gets an end bit.
+        {
+            uint64_t mask = ~uint64_t(0) << (end - s);
 
-    while (true)
-    {
-        const char* optionCStr = va_arg(args, const char*);
-        if (!optionCStr)
-            break;
+            for (int i = 0; s < end; s++, i++)
+                mask |= uint64_t(mSeparators.mIsSeparator[(unsigned char) *s]) << i;
 
-        string options(optionCStr);
-        string nextToken;
+            return mask;
+        }
 
-        // is this an enum specification? (:enumName).
-        if (!options.empty() && (options[0] == kEnumSpecChar || options[0] == kEnumSpecInlineChar))
+        uint64_t SeparatorMask(const char* s) const
         {
-            if (options[0] == kEnumSpecChar)
-                mEnumSpecs.push_back(cEnumSpec(options.c_str() + 1, va_arg(args, cArgEnumInfo*)));
-            else
-            {
-                mEnumSpecs.push_back(cEnumSpec(options.c_str() + 1, nullptr));
+            int numChars = mSeparators.mNumChars;
+            uint64_t mask = 0;
 
-                while (true)
+        #if defined(AS_AVX2)
+            if (numChars >= 0)
+            {
+                for (int j = 0; j < 64; j += 32)
                 {
-                    const char* enumToken = va_arg(args, const char*);
-                    if (!enumToken)
-                        break;
+                    __m256i v = _mm256_loadu_si256((const __m256i*) (s + j));
+                    __m256i match = _mm256_setzero_si256();
 
-                    int enumValue = va_arg(args, int);  // skip nth value
-                    mEnumSpecs.back().mEnumInfoStore.push_back( { enumToken, enumValue } );
+                    for (int i = 0; i < numChars; i++)
+                        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(mSeparators.mChars[i])));
+
+                    mask |= uint64_t(uint32_t(_mm256_movemask_epi8(match))) << j;
                 }
 
-                mEnumSpecs.back().mEnumInfoStore.push_back( { nullptr, 0 } );
-                mEnumSpecs.back().mEnumInfo = mEnumSpecs.back().mEnumInfoStore.data();
+                return mask;
             }
+        #elif defined(AS_SSE2)
+            if (numChars >= 0)
+            {
+                for (int j = 0; j < 64; j += 16)
+                {
+                    __m128i v = _mm_loadu_si128((const __m128i*) (s + j));
+                    __m128i match = _mm_setzero_si128();
 
-            continue;
-        }
-
-        nextToken = NextToken(options);
-
-        vector<cArgInfo>* argsToAddTo = 0;
-        cOptionsSpec newOption;
+                    for (int i = 0; i < numChars; i++)
+                        match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8(mSeparators.mChars[i])));
 
-        // is it an option, or should it be added to the default arguments?
-        bool isOption = IsOption(nextToken.c_str());
+                    mask |= uint64_t(uint32_t(_mm_movemask_epi8(match))) << j;
+                }
 
-        if (isOption)
-        {
-            if (nextToken[nextToken.length() - 1] == kSetFlagChar)
-            {
-                nextToken.erase(nextToken.length() - 1, 1);
-                newOption.mFlagToSet = va_arg(args, int);
+                return mask;
             }
-            else
-                newOption.mFlagToSet = -1;
+        #endif
 
-            newOption.mName.assign(nextToken, 1, string::npos);
+            for (int i = 0; i < 64; i++)
+                mask |= uint64_t(mSeparators.mIsSeparator[(unsigned char) s[i]]) << i;
 
-            nextToken = NextToken(options);
-            argsToAddTo = &newOption.mArguments;
+            return mask;
         }
-        else
-            argsToAddTo = &mMainArgs.mArguments;
-
-        int optionLevel = 0;
-        int lastOptionLevel = 0;
+    };
 
-        while (!nextToken.empty())
+    template<class T_VECTOR> void TokenizeInPlace(char* s, char* end, T_VECTOR* tokens)
+    // Splits s..end into white-space separated tokens, appending them to
+    // 'tokens'. Quotes group characters and are removed, as are backslash
+    // escapes outside single quotes. Tokens are compacted and NUL-terminated
+    // in place, so *end must be writable.
+    {
+        while (true)
         {
-            cArgInfo newArgInfo;
+            while (s < end && isspace((unsigned char) *s))
+                s++;
 
-            if (nextToken[0] == kOpenBracketChar)
-            {
-                optionLevel++;
-                nextToken.erase(0, 1);
-            }
+            if (s >= end)
+                break;
 
-            newArgInfo.mIsRequired = (optionLevel == lastOptionLevel);
+            char* token = s;
+            char* w = s;
+            char quote = 0;
 
-            while (!nextToken.empty() && nextToken[nextToken.size() - 1] == kCloseBracketChar)
+            for ( ; s < end; s++)
             {
-                optionLevel--;
-                nextToken.erase(nextToken.length() - 1, 1);
-            }
+                char c = *s;
 
-            if (Eq(nextToken, kEllipsisToken))
-            {
-                if (!options.empty())
-                    return kSpecEllipsisError;
-                if (argsToAddTo->empty())
-                    return kSpecEllipsisError;
+                if (quote)
+                {
+                    if (c == quote)
+                    {
+                        quote = 0;
+                        continue;
+                    }
+
+                    if (c == '\\' && quote == '"' && s + 1 < end)
+                        c = *++s;
+                }
+                else if (isspace((unsigned char) c))
+                    break;
+                else if (c == '"' || c == '\'')
+                {
+                    quote = c;
+                    continue;
+                }
+                else if (c == '\\' && s + 1 < end)
+                    c = *++s;
 
-                argsToAddTo->back().mType = argsToAddTo->back().mType | kTypeArrayListFlag;
-                nextToken = NextToken(options);
-                continue;
+                *w++ = c;
             }
 
-            // fetch var args: location and optionally flag
-            newArgInfo.mLocation    = va_arg(args, void*);
-
-            if (nextToken[nextToken.length() - 1] == kSetFlagChar)
-            {
-                nextToken.erase(nextToken.length() - 1, 1);
-                newArgInfo.mFlagToSet = va_arg(args, int);
-            }
-            else
-                newArgInfo.mFlagToSet = -1;
+            *w = 0;     // w <= s, so at worst this overwrites the separator we stopped on
+            tokens->push_back(token);
 
-            FindNameAndTypeFromOption(nextToken, &newArgInfo.mType, &newArgInfo.mName);
+            if (s < end)
+                s++;
+        }
+    }
 
-            if (newArgInfo.mType == kTypeInvalid)
-                err = kSpecUnknownType; // register error but carry on; we can mostly survive this.
+    struct cSpecToken
+    /// Non-owning view of part of a spec string.
+    {
+        const char* mBegin = nullptr;
+        const char* mEnd   = nullptr;
+
+        bool   Empty() const        { return mBegin == mEnd; }
+        size_t Size() const         { return size_t(mEnd - mBegin); }
+        char   Front() const        { return mBegin[0]; }
+        char   Back() const         { return mEnd[-1]; }
+        bool   Is(const char* s) const { return Size() == strlen(s) && Eq(mBegin, s, Size()); }
+    };
 
-            argsToAddTo->push_back(newArgInfo);
+    inline bool IsSpecSeparator(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n';
+    }
 
-            lastOptionLevel = optionLevel;
-            nextToken = NextToken(options);
-        }
+    inline cSpecToken NextSpecToken(const char*& s)
+    // Returns the next white-space separated token of s, advancing s past it,
+    // or an empty token at the end. Nothing is copied.
+    {
+        while (IsSpecSeparator(*s))
+            s++;
 
-        if (optionLevel != 0)
-        {
-            err = kSpecUnbalancedBrackets;
-            break;
-        }
+        cSpecToken token;
+        token.mBegin = s;
 
-        const char* docCString = va_arg(args, const char*);
-        AS_ASSERT_F(docCString && strlen(docCString) < 500, "Bad argument spec around '%s'\n", optionCStr);   // often we'll crash here if the spec is confused.
-        string docString = docCString;
+        while (*s && !IsSpecSeparator(*s))
+            s++;
 
-        if (isOption)
-        {
-            newOption.mDescription = docString;
-            mOptions.push_back(newOption);
-        }
-        else
-            mMainArgs.mDescription += docString;
+        token.mEnd = s;
+        return token;
     }
-
-    return err;
 }
 
-tArgError cArgSpec::Internal::Parse(int argc, const char** argv)
+namespace Detail
 {
-    // chomp name.
-    const char** argvEnd = argv + argc;
-    const char* commandName = *argv++;
-
-    // if they've supplied nothing at all, just show them the help
-    if (argc == 1 && !mMainArgs.mArguments.empty())
+    // Files
+    struct cMappedFile
+    /// View of a file's contents, memory-mapped where available. If opened
+    /// as writable, the mapping is a private copy-on-write one, and there is
+    /// always a writable byte after the end, so it can be tokenized in place.
     {
-        CreateHelpString(commandName, &mErrorString, kHelpFull);
-        return kArgHelpRequested;
-    }
+        char*        mData   = nullptr;
+        size_t       mSize   = 0;
+        uint64_t     mID[2]  = {};      // identifies the underlying file, where supported
+        bool         mMapped = false;
+        tArgVector<char> mBuffer;       // used if we can't map
 
-    // clear state
-    mFlags = 0;
-    mErrorString.clear();
+        cMappedFile() = default;
+        cMappedFile(const cMappedFile&) = delete;
+        cMappedFile& operator=(const cMappedFile&) = delete;
+        ~cMappedFile() { Close(); }
 
-    tArgError error;
-    size_t i = 0;
-    size_t n = mMainArgs.mArguments.size();
+        bool Open(const char* path, bool writable = false);
+        void Close();
 
-    while (argv < argvEnd)
-    {
-        if (IsOption(*argv))
+        void Swap(cMappedFile& other)
         {
-            error = ParseOption(argv, argvEnd);
+            std::swap(mData, other.mData);
+            std::swap(mSize, other.mSize);
+            std::swap(mID[0], other.mID[0]);
+            std::swap(mID[1], other.mID[1]);
+            std::swap(mMapped, other.mMapped);
+            mBuffer.swap(other.mBuffer);
+        }
+    };
 
-            if (error != kArgNoError)
-            {
-                if (error == kArgHelpRequested)
-                    CreateHelpString(commandName, &mErrorString, kHelpFull);
+#ifdef _WIN32
+    bool cMappedFile::Open(const char* path, bool)
+    {
+        Close();
 
-                return error;
-            }
-        }
-        else if (i < n)
-        {
-            error = ParseArgument(mMainArgs.mArguments[i], argv, argvEnd);
+        FILE* file = fopen(path, "rb");
+        if (!file)
+            return false;
 
-            if (error != kArgNoError)
-                return error;
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
 
-            i++;
-        }
-        else
-        {
-            Sprintf(&mErrorString, "Too many main arguments (expecting at most %d)\n", n);
-            return kArgErrorTooManyArgs;
-        }
+        mBuffer.resize(size_t(size) + 1);
+        mSize = fread(mBuffer.data(), 1, size_t(size), file);
+        mBuffer[mSize] = 0;
+        mData = mBuffer.data();
+
+        fclose(file);
+        return true;
     }
 
-    if (!mHelpRequested && i < n && mMainArgs.mArguments[i].mIsRequired)
+    void cMappedFile::Close()
     {
-        size_t numHave = i;
+        mBuffer.clear();
+        mData = nullptr;
+        mSize = 0;
+    }
+#else
+    bool cMappedFile::Open(const char* path, bool writable)
+    {
+        Close();
 
-        do
-            i++;
-        while (i < n && mMainArgs.mArguments[i].mIsRequired);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
 
-        Sprintf(&mErrorString, "Not enough main arguments: expecting at least %d more", i - numHave);
+        struct stat st;
+        bool success = fstat(fd, &st) == 0;
 
-        return kArgErrorNotEnoughArgs;
-    }
+        if (success)
+        {
+            size_t size = size_t(st.st_size);
 
-    return kArgNoError;
-}
+            mID[0] = uint64_t(st.st_dev);
+            mID[1] = uint64_t(st.st_ino);
 
-void cArgSpec::Internal::CreateHelpString(const char* commandName, string* helpString, tHelpType helpType) const
+            if (writable && size % size_t(sysconf(_SC_PAGESIZE)) == 0)
+            {
+                // No slack at the end of the last page for a terminator, so read instead
+                mBuffer.resize(size + 1);
+
+                ssize_t numRead = size > 0 ? read(fd, mBuffer.data(), size) : 0;
+                success = numRead == ssize_t(size);
+
+                mBuffer[size] = 0;
+                mData = mBuffer.data();
+                mSize = size;
+            }
+            else if (size > 0)
+            {
+                void* data = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (data != MAP_FAILED)
+                {
+                    mData   = static_cast<char*>(data);
+                    mSize   = size;
+                    mMapped = true;
+                }
+                else
+                    success = false;
+            }
+        }
+
+        close(fd);
+        return success;
+    }
+
+    void cMappedFile::Close()
+    {
+        if (mMapped)
+            munmap(mData, mSize);
+
+        mBuffer.clear();
+        mData   = nullptr;
+        mSize   = 0;
+        mMapped = false;
+    }
+#endif
+}
+
+namespace
 {
-    if (helpType == kHelpBrief)
+    // Numbers
+    //
+    // These are locale-independent and allocation-free, and work on ranges
+    // rather than NUL-terminated strings, so values can be converted in
+    // place from wherever they sit.
+
+    inline int DigitValue(char c)
+    // Returns value of c as a base-36 digit, or 36 if it isn't one.
     {
-        Sprintf(helpString, "%s, %s", commandName, mCommandDescription.c_str());
-        return;
+        unsigned d = unsigned(c) - '0';
+        if (d < 10)
+            return int(d);
+
+        unsigned a = unsigned(c | 0x20) - 'a';
+        if (a < 26)
+            return int(a + 10);
+
+        return 36;
     }
 
-    if (helpType == kHelpHTML)
+    tArgError ScanInt(const char*& s, const char* end, int64_t minValue, int64_t maxValue, int64_t* result)
+    // Parses an optionally signed decimal, 0x hex, or 0-prefixed octal integer from s,
+    // as for strtol(s, 0), advancing s past it.
     {
-        SprintfAppend(helpString, "<tr><td><a name=\"%s\"></a>", commandName);    // start frame
-        SprintfAppend(helpString, "<p>%s</p>\n\n", mCommandDescription.c_str());
-        SprintfAppend(helpString, "<p><h3>Usage</h3></p>\n");
+        bool negative = false;
 
-        SprintfAppend(helpString, "<b>%s</b> ", commandName);
+        if (s < end && (*s == '-' || *s == '+'))
+            negative = (*s++ == '-');
 
-        if (!mOptions.empty())
-            *helpString += "[options] ";
+        int base = 10;
 
-        AddArgDocs(helpString, mMainArgs.mArguments, helpType);
+        if (end - s >= 2 && s[0] == '0')
+        {
+            if ((s[1] | 0x20) == 'x' && end - s >= 3 && DigitValue(s[2]) < 16)
+            {
+                base = 16;
+                s += 2;
+            }
+            else if (DigitValue(s[1]) < 10)     // so "08" is bad octal, as for strtol(), rather than decimal
+            {
+                base = 8;
+                s++;
+            }
+        }
 
-        helpString->append("<br><blockquote><p>");
-        AddDocString(helpString, "", mMainArgs.mDescription);
-        helpString->append("</blockquote>\n");
+        const char* digits = s;
+        uint64_t limit = negative ? uint64_t(0) - uint64_t(minValue) : uint64_t(maxValue);
+        uint64_t cutoff = limit / base;
+        int cutoffDigit = int(limit % base);
+        uint64_t value = 0;
+        bool overflow = false;
 
-        if (!mOptions.empty())
+        for (int d; s < end && (d = DigitValue(*s)) < base; s++)
         {
-            SprintfAppend(helpString, "<p><h3>Options</h3></p>\n");
+            if (value > cutoff || (value == cutoff && d > cutoffDigit))
+                overflow = true;
+            else
+                value = value * base + d;
+        }
 
-            for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+        if (s == digits)
+            return kArgErrorGarbage;
+        if (overflow)
+            return kArgErrorRange;
+
+        *result = negative ? int64_t(uint64_t(0) - value) : int64_t(value);
+        return kArgNoError;
+    }
+
+    template<class T> struct cRealTraits;
+
+    template<> struct cRealTraits<double>
+    {
+        static constexpr uint64_t kMaxExactMantissa = uint64_t(1) << 53;
+        static constexpr int      kMaxExactPow10    = 22;
+
+        static double Pow10(int i)
+        {
+            static const double kPow10[kMaxExactPow10 + 1] =
             {
-                SprintfAppend(helpString, "<b>-%s</b> ", mOptions[j].mName.c_str());
-                AddArgDocs(helpString, mOptions[j].mArguments, helpType);
-                helpString->append("<br><blockquote>");
-                AddDocString(helpString, "", mOptions[j].mDescription);
-                helpString->append("</blockquote>");
-            }
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+
+            return kPow10[i];
         }
 
-        if (!mEnumSpecs.empty())
+        static double StrTo(const char* s, char** sEnd) { return strtod(s, sEnd); }
+    };
+
+    template<> struct cRealTraits<float>
+    {
+        static constexpr uint64_t kMaxExactMantissa = uint64_t(1) << 24;
+        static constexpr int      kMaxExactPow10    = 10;
+
+        static float Pow10(int i)
         {
-            helpString->append("\n<p><h3>Types</h3></p>");
-            AddEnumDocs(helpString, "", mEnumSpecs, helpType);
+            static const float kPow10[kMaxExactPow10 + 1] =
+            {
+                1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+            };
+
+            return kPow10[i];
         }
 
-        helpString->append("</td></tr>");       // end frame
-        return;
+        static float StrTo(const char* s, char** sEnd) { return strtof(s, sEnd); }
+    };
+
+    template<class T> tArgError ScanRealSlow(const char*& s, const char* end, T* result)
+    // Fallback for hex floats, inf/nan, and values the fast path can't round
+    // exactly. strtod() expects the locale's decimal point, so we swap that in.
+    {
+        char buffer[128];
+        tArgString longBuffer;
+        size_t length = end - s;
+        char* copy = buffer;
+
+        if (length >= sizeof(buffer))
+        {
+            longBuffer.resize(length);
+            copy = &longBuffer[0];
+        }
+
+        memcpy(copy, s, length);
+        copy[length] = 0;
+
+        char decimalPoint = localeconv()->decimal_point[0];
+
+        if (decimalPoint != '.')
+            if (char* point = static_cast<char*>(memchr(copy, '.', length)))
+                *point = decimalPoint;
+
+        char* copyEnd;
+        *result = cRealTraits<T>::StrTo(copy, &copyEnd);
+
+        if (copyEnd == copy)
+            return kArgErrorGarbage;
+
+        s += copyEnd - copy;
+        return kArgNoError;
     }
 
-    if (helpType == kHelpMarkdown)
+    template<class T> tArgError ScanReal(const char*& s, const char* end, T* result)
+    // Parses a decimal floating point number from s, advancing s past it. Where
+    // the significand and power of ten are both exactly representable in T, a
+    // single multiply or divide gives the correctly rounded result (Clinger's
+    // fast path), which covers almost all values seen on a command line.
     {
-    #ifdef AS_MD_USE_DD
-        SprintfAppend(helpString, "%s\n\n### Usage\n\n**%s** ", mCommandDescription.c_str(), commandName);
-    #else
-        SprintfAppend(helpString, "%s\n\n### Usage\n> **%s** ", mCommandDescription.c_str(), commandName);
-    #endif
+        const char* start = s;
+        bool negative = false;
 
-        if (!mOptions.empty())
-            *helpString += "[*options*] ";
+        if (s < end && (*s == '-' || *s == '+'))
+            negative = (*s++ == '-');
 
-        AddArgDocs(helpString, mMainArgs.mArguments, helpType);
-    #ifdef AS_MD_USE_DD
-        *helpString += "\n<dl><dd>    ";
-        *helpString += mMainArgs.mDescription;
-        *helpString += "    </dd></dl>\n\n";
-    #else
-        *helpString += ">>  ";
-        *helpString += mMainArgs.mDescription;
-        *helpString += "\n";
-    #endif
-        if (!mOptions.empty())
+        uint64_t mantissa = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        bool haveDigits = false;
+
+        for ( ; s < end && unsigned(*s - '0') < 10; s++)
         {
-            SprintfAppend(helpString, "\n### Options\n\n");
+            if (numDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*s - '0');
+                numDigits += (mantissa != 0);
+            }
+            else
+                exponent++;     // the fast path will reject this anyway
 
-            for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+            haveDigits = true;
+        }
+
+        if (s < end && (*s | 0x20) == 'x')     // hex float
+        {
+            s = start;
+            return ScanRealSlow(s, end, result);
+        }
+
+        if (s < end && *s == '.')
+        {
+            for (s++; s < end && unsigned(*s - '0') < 10; s++)
             {
-            #ifdef AS_MD_USE_DD
-                SprintfAppend(helpString, "**-%s** ", mOptions[j].mName.c_str());
-            #else
-                SprintfAppend(helpString, "> **-%s** ", mOptions[j].mName.c_str());
-            #endif
-                AddArgDocs(helpString, mOptions[j].mArguments, helpType);
-            #ifdef AS_MD_USE_DD
-                *helpString += "\n<dl><dd>    ";
-                *helpString += mOptions[j].mDescription;
-                *helpString += "    </dd></dl>\n\n";
-            #else
-                *helpString += ">>  ";
-                *helpString += mOptions[j].mDescription;
-                *helpString += "\n\n";
-            #endif
+                if (numDigits < 19)
+                {
+                    mantissa = mantissa * 10 + (*s - '0');
+                    numDigits += (mantissa != 0);
+                    exponent--;
+                }
+
+                haveDigits = true;
             }
         }
 
-        if (!mEnumSpecs.empty())
+        if (!haveDigits || numDigits >= 19)
         {
-            SprintfAppend(helpString, "\n### Types\n");
-        #ifdef AS_MD_USE_DD
-            AddEnumDocs(helpString, "", mEnumSpecs, helpType);
-        #else
-            AddEnumDocs(helpString, "> ", mEnumSpecs, helpType);
-        #endif
+            s = start;
+            return ScanRealSlow(s, end, result);
         }
 
-        return;
+        if (s < end && (*s | 0x20) == 'e')
+        {
+            const char* e = s + 1;
+            bool negativeExp = false;
+
+            if (e < end && (*e == '-' || *e == '+'))
+                negativeExp = (*e++ == '-');
+
+            if (e < end && unsigned(*e - '0') < 10)
+            {
+                int value = 0;
+
+                for ( ; e < end && unsigned(*e - '0') < 10; e++)
+                    if (value < 100000)
+                        value = value * 10 + (*e - '0');
+
+                exponent += negativeExp ? -value : value;
+                s = e;
+            }
+        }
+
+        typedef cRealTraits<T> tTraits;
+
+        if (mantissa > tTraits::kMaxExactMantissa || exponent < -tTraits::kMaxExactPow10 || exponent > tTraits::kMaxExactPow10)
+        {
+            if (mantissa == 0)
+            {
+                *result = negative ? -T(0) : T(0);
+                return kArgNoError;
+            }
+
+            s = start;
+            return ScanRealSlow(s, end, result);
+        }
+
+        T value = T(mantissa);
+
+        if (exponent < 0)
+            value /= tTraits::Pow10(-exponent);
+        else
+            value *= tTraits::Pow10(exponent);
+
+        *result = negative ? -value : value;
+        return kArgNoError;
+    }
+
+    const cArgEnumInfo kBoolTokens[] =
+    {
+        { "true",  1 },
+        { "false", 0 },
+        { "on",    1 },
+        { "off",   0 },
+        { "yes",   1 },
+        { "no",    0 },
+    };
+
+    tArgError ScanBool(const char*& s, const char* end, bool* result)
+    // Parses one of kBoolTokens, or an integer, where non-zero is true.
+    {
+        size_t length = end - s;
+
+        if (length <= 5 && length > 0 && DigitValue(*s) >= 10)
+        {
+            for (const cArgEnumInfo& info : kBoolTokens)
+                if (Eq(s, info.mToken, length) && info.mToken[length] == 0)
+                {
+                    *result = info.mValue != 0;
+                    s = end;
+                    return kArgNoError;
+                }
+        }
+
+        int64_t i;
+        tArgError error = ScanInt(s, end, INT64_MIN, INT64_MAX, &i);
+
+        if (error == kArgNoError)
+            *result = (i != 0);
+
+        return error;
     }
 
-    SprintfAppend(helpString, "%s\n\nUsage:\n    %s ", mCommandDescription.c_str(), commandName);
+    template<class T> inline tArgError CheckEnd(tArgError error, const char* s, const char* end, T value, T* location)
+    {
+        if (error != kArgNoError)
+            return error;
+        if (s != end)
+            return kArgErrorGarbage;
+
+        if (location)
+            *location = value;
 
-    if (!mOptions.empty())
-        *helpString += "[options] ";
+        return kArgNoError;
+    }
 
-    AddArgDocs(helpString, mMainArgs.mArguments, helpType);
-    if (!mMainArgs.mDescription.empty())
-        AddDocString(helpString, "        ", mMainArgs.mDescription);
+    tArgError Parse(int* location, const char* arg, const char* argEnd)
+    {
+        int64_t result = 0;
+        tArgError error = ScanInt(arg, argEnd, INT_MIN, INT_MAX, &result);
+        return CheckEnd(error, arg, argEnd, int(result), location);
+    }
 
-    if (!mOptions.empty())
+    tArgError Parse(bool* location, const char* arg, const char* argEnd)
+    {
+        bool result = false;
+        tArgError error = ScanBool(arg, argEnd, &result);
+        return CheckEnd(error, arg, argEnd, result, location);
+    }
+
+    tArgError Parse(float* location, const char* arg, const char* argEnd)
     {
-        SprintfAppend(helpString, "\nOptions:\n");
+        float result = 0.0f;
+        tArgError error = ScanReal(arg, argEnd, &result);
+        return CheckEnd(error, arg, argEnd, result, location);
+    }
 
-        for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+    tArgError Parse(double* location, const char* arg, const char* argEnd)
+    {
+        double result = 0.0;
+        tArgError error = ScanReal(arg, argEnd, &result);
+        return CheckEnd(error, arg, argEnd, result, location);
+    }
+
+    tArgError Parse(int* location, const char* arg)
+    {
+        return Parse(location, arg, arg + strlen(arg));
+    }
+
+    tArgError Parse(bool* location, const char* arg)
+    {
+        return Parse(location, arg, arg + strlen(arg));
+    }
+
+    tArgError Parse(float* location, const char* arg)
+    {
+        return Parse(location, arg, arg + strlen(arg));
+    }
+
+    tArgError Parse(double* location, const char* arg)
+    {
+        return Parse(location, arg, arg + strlen(arg));
+    }
+
+    tArgError Parse(int n, float v[], const char**& argv, const char** argvEnd)
+    {
+        int i = 0;
+
+        for (i = 0; i < n && argv < argvEnd && !IsOption(*argv); i++)
+        {
+            tArgError err = Parse(v + i, *argv++);
+
+            if (err != kArgNoError)
+                return err;
+        }
+
+        if (i == 1)     // treat single arg as vecn(s)
+            for (int j = i; j < n; j++)
+                v[j] = v[0];
+        else            // otherwise zero-fill
+            for (int j = i; j < n; j++)
+                v[j] = 0.0f;
+
+        return kArgNoError;
+    }
+
+    tArgError Parse(const char** location, const char* arg)
+    {
+        if (location)
+            *location = arg;
+        return kArgNoError;
+    }
+    tArgError Parse(string* location, const char* arg)
+    {
+        if (location)
+            *location = arg;
+        return kArgNoError;
+    }
+    tArgError Parse(string* location, const char* arg, const char* argEnd)
+    {
+        if (location)
+            location->assign(arg, argEnd);
+        return kArgNoError;
+    }
+
+    // Enums
+    struct cEnumSpec
+    /// An enum's tokens and values. These come either from a cArgEnumInfo
+    /// table, or, for large enums, a dictionary file that is mapped rather
+    /// than copied. Either way tokens are looked up via a hash table built
+    /// up front by Index().
+    {
+        struct cToken
+        {
+            uint32_t mOffset;   // of token within mFile
+            uint32_t mLength;
+            int      mValue;
+        };
+
+        cEnumSpec(const char* name, const cArgEnumInfo* enumInfo) :
+            mName(name),
+            mEnumInfo(enumInfo)
+        {}
+
+        tArgString           mName;
+        const cArgEnumInfo*  mEnumInfo;
+        tArgVector<cArgEnumInfo> mEnumInfoStore;    // for inline enums
+
+        tArgString           mPath;             // for dictionary enums, which have mFile/mTokens rather than mEnumInfo
+        std::unique_ptr<cMappedFile, cArgDeleter> mFile;
+        tArgVector<cToken>   mTokens;
+
+        size_t               mNumTokens = 0;
+        cNameTable           mTable;            // token -> index
+
+        bool        Load(const char* path);
+        void        Index();
+
+        const char* Token(size_t i, size_t* length) const;
+        int         Value(size_t i) const { return mEnumInfo ? mEnumInfo[i].mValue : mTokens[i].mValue; }
+        int         Find(const char* s, size_t length) const;
+    };
+
+    bool cEnumSpec::Load(const char* path)
+    // Read a dictionary of the form "token [value]" per line. As with C
+    // enums, a missing value is one more than the previous one. Leading
+    // white space is ignored, and blank lines and those starting with '#'
+    // are skipped.
+    {
+        mPath = path;
+        mEnumInfo = nullptr;
+        mFile = std::unique_ptr<cMappedFile, cArgDeleter>(NewArg<cMappedFile>(tCurrentAllocator), cArgDeleter { tCurrentAllocator });
+        mTokens.clear();
+
+        if (!mFile->Open(path) || mFile->mSize > UINT32_MAX)
+            return false;
+
+        const char* data = mFile->mData;
+        const char* end  = data + mFile->mSize;
+        int64_t nextValue = 0;
+
+        for (const char* s = data; s < end; )
         {
-            SprintfAppend(helpString, "    -%s ", mOptions[j].mName.c_str());
-            AddArgDocs(helpString, mOptions[j].mArguments, helpType);
-            AddDocString(helpString, "        ", mOptions[j].mDescription);
+            const char* lineEnd = static_cast<const char*>(memchr(s, '\n', end - s));
+
+            if (!lineEnd)
+                lineEnd = end;
+
+            const char* token = s;
+
+            while (token < lineEnd && isspace((unsigned char) *token))
+                token++;
+
+            const char* tokenEnd = token;
+
+            while (tokenEnd < lineEnd && !isspace((unsigned char) *tokenEnd))
+                tokenEnd++;
+
+            if (tokenEnd != token && *token != '#')
+            {
+                const char* v = tokenEnd;
+
+                while (v < lineEnd && isspace((unsigned char) *v))
+                    v++;
+
+                if (v < lineEnd)
+                {
+                    if (ScanInt(v, lineEnd, INT_MIN, INT_MAX, &nextValue) != kArgNoError)
+                        return false;
+
+                    while (v < lineEnd && isspace((unsigned char) *v))
+                        v++;
+
+                    if (v != lineEnd)
+                        return false;
+                }
+
+                mTokens.push_back( { uint32_t(token - data), uint32_t(tokenEnd - token), int(nextValue) } );
+                nextValue = int(nextValue) + int64_t(1);
+            }
+
+            s = lineEnd + 1;
         }
+
+        return true;
     }
 
-    if (!mEnumSpecs.empty())
+    void cEnumSpec::Index()
+    {
+        mNumTokens = 0;
+
+        if (mEnumInfo)
+            while (mEnumInfo[mNumTokens].mToken)
+                mNumTokens++;
+        else
+            mNumTokens = mTokens.size();
+
+        mTable.Clear();
+        mTable.Reserve(int(mNumTokens));
+
+        for (size_t i = 0; i < mNumTokens; i++)
+        {
+            size_t length;
+            const char* token = Token(i, &length);
+
+            if (Find(token, length) < 0)    // first of any duplicates wins, as with a linear search
+                mTable.Insert(FoldedHash(token, length), int(i));
+        }
+    }
+
+    const char* cEnumSpec::Token(size_t i, size_t* length) const
+    {
+        if (mEnumInfo)
+        {
+            *length = strlen(mEnumInfo[i].mToken);
+            return mEnumInfo[i].mToken;
+        }
+
+        *length = mTokens[i].mLength;
+        return mFile->mData + mTokens[i].mOffset;
+    }
+
+    int cEnumSpec::Find(const char* s, size_t length) const
+    // Returns the index of the given token, or -1
+    {
+        return mTable.Find(FoldedHash(s, length),
+            [&](int i)
+            {
+                if (mEnumInfo)
+                    return Eq(s, mEnumInfo[i].mToken, length) && mEnumInfo[i].mToken[length] == 0;
+
+                return mTokens[i].mLength == length && Eq(s, mFile->mData + mTokens[i].mOffset, length);
+            }
+        );
+    }
+
+    tArgError Parse(int* location, const cEnumSpec& enumSpec, const char* arg, const char* argEnd)
+    {
+        int index = enumSpec.Find(arg, argEnd - arg);
+
+        if (index < 0)
+            return kArgErrorBadEnum;
+
+        if (location)
+            *location = enumSpec.Value(index);
+
+        return kArgNoError;
+    }
+
+    tArgError Parse(int* location, const cEnumSpec& enumSpec, const char* arg)
+    {
+        return Parse(location, enumSpec, arg, arg + strlen(arg));
+    }
+
+
+    // Doc helpers
+    struct cHelpOutput
+    /// Accumulates help text in a fixed buffer, passing it on to the writer
+    /// whenever that fills, so help is streamed rather than built up as one
+    /// string. Text too large for the buffer is passed on directly.
+    {
+        cArgSpec::tHelpWriter* mWriter;
+        void*                  mUserData;
+        size_t                 mUsed = 0;
+        char                   mBuffer[4096];
+
+        cHelpOutput(cArgSpec::tHelpWriter* writer, void* userData) : mWriter(writer), mUserData(userData) {}
+        ~cHelpOutput() { Flush(); }
+
+        // Help output is a long run of small Puts, so keep these inlined even
+        // when the rest of the unit has used up the compiler's inlining budget.
+        AS_FORCE_INLINE void Put(const char* s, size_t n)
+        {
+            if (n > sizeof(mBuffer) - mUsed)
+                return PutOverflow(s, n);
+
+            memcpy(mBuffer + mUsed, s, n);
+            mUsed += n;
+        }
+
+        void PutOverflow(const char* s, size_t n)
+        {
+            Flush();
+
+            if (n >= sizeof(mBuffer))
+                mWriter(mUserData, s, n);
+            else
+            {
+                memcpy(mBuffer, s, n);
+                mUsed = n;
+            }
+        }
+
+        AS_FORCE_INLINE void Put(const char* s)         { Put(s, strlen(s)); }
+        AS_FORCE_INLINE void Put(const tArgString& s)   { Put(s.data(), s.size()); }
+        AS_FORCE_INLINE void Put(char c)                { Put(&c, 1); }
+
+        void PutCount(size_t count)
+        {
+            char buffer[32];
+            Put(buffer, size_t(snprintf(buffer, sizeof(buffer), "%zu", count)));
+        }
+
+        void Flush()
+        {
+            if (mUsed > 0)
+                mWriter(mUserData, mBuffer, mUsed);
+
+            mUsed = 0;
+        }
+    };
+
+    template<class T_STRING> void AppendToString(void* userData, const char* data, size_t size)
+    {
+        static_cast<T_STRING*>(userData)->append(data, size);
+    }
+
+    void AddDocString(cHelpOutput* out, const char* leader, const tArgString& docString)
+    {
+        size_t lastLF = 0;
+        size_t nextLF;
+
+        do
+        {
+            nextLF = docString.find('\n', lastLF);
+
+            out->Put(leader);
+            out->Put(docString.data() + lastLF, (nextLF == tArgString::npos ? docString.size() : nextLF) - lastLF);
+            out->Put('\n');
+
+            lastLF = nextLF + 1;
+        }
+        while (nextLF != tArgString::npos);
+    }
+
+    void AddEnumDocs(cHelpOutput* out, const char* leader, const tArgVector<cEnumSpec>& enumSpecs, tHelpType helpType)
+    {
+        for (size_t i = 0, n = enumSpecs.size(); i < n; i++)
+        {
+            const cEnumSpec& enumSpec = enumSpecs[i];
+
+            if (helpType == kHelpHTML)
+            {
+                out->Put("<p><b>");
+                out->Put(enumSpec.mName);
+                out->Put("</b></p><blockquote><i>");
+            }
+            else if (helpType == kHelpMarkdown)
+            {
+                out->Put('\n');
+                out->Put(leader);
+                out->Put("**");
+                out->Put(enumSpec.mName);
+                out->Put("**\n\n");
+            }
+            else
+            {
+                out->Put('\n');
+                out->Put(leader);
+                out->Put(enumSpec.mName);
+                out->Put(":\n");
+            }
+
+            if (!enumSpec.mPath.empty())
+            {
+                // Dictionaries are too large to list
+                if (helpType != kHelpHTML)
+                {
+                    out->Put(leader);
+                    out->Put(helpType == kHelpMarkdown ? "- " : "   ");
+                }
+
+                out->PutCount(enumSpec.mNumTokens);
+                out->Put(helpType == kHelpMarkdown ? " values from `" : " values from ");
+                out->Put(enumSpec.mPath);
+                out->Put(helpType == kHelpHTML ? "</br>\n" : helpType == kHelpMarkdown ? "`\n" : "\n");
+            }
+
+            for (const cArgEnumInfo* argEnum = enumSpec.mEnumInfo; argEnum && argEnum->mToken; argEnum++)
+            {
+                if (helpType == kHelpHTML)
+                {
+                    out->Put(argEnum->mToken);
+                    out->Put("</br>\n");
+                    continue;
+                }
+
+                out->Put(leader);
+                out->Put(helpType == kHelpMarkdown ? "- " : "   ");
+                out->Put(argEnum->mToken);
+                out->Put('\n');
+            }
+
+            if (helpType == kHelpHTML)
+                out->Put("</i></blockquote>");
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgSpec::Internal declaration
+//
+
+namespace
+{
+    // Declarations
+    enum tArgType : uint32_t
+    {
+        kTypeInvalid,
+        kTypeBool,
+        kTypeInt,
+        kTypeFloat,
+        kTypeDouble,
+        kTypeCString,    // char*
+        kTypeString,     // string
+        kTypeVec2,
+        kTypeVec3,
+        kTypeVec4,
+        kTypeEnumBegin,                     // enum types follow, one per cEnumSpec
+
+        kTypeArraySplitFlag  = 0x20000000,  // array type: expecting "a b c ..."
+        kTypeArrayListFlag   = 0x40000000,  // array type, expecting to use remaining argument list (or until next option)
+        kTypeBaseMask        = 0x1FFFFFFF
+    };
+    inline tArgType operator | (tArgType a, tArgType b)
+    { return tArgType(int(a) | int(b)); }
+
+    struct cArgInfo;
+
+    typedef tArgError (*tArgConverter)(cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd);
+
+    struct cArgInfo
+    {
+        tArgType     mType;        // type of argument
+        tArgString   mName;        // name for argument (optional)
+        void*        mLocation;    // pointer to result
+        int          mBinding;     // index of mLocation in the original spec's variable list
+        bool         mIsRequired;  // present iff the previous argument is.
+        int          mFlagToSet;   // if +ve, set this flag if we see this argument
+
+        tArgConverter       mConvert    = nullptr;  // parses arguments of mType into mLocation, see ResolveConverters()
+        const cEnumSpec*    mEnumSpec   = nullptr;  // for enum types
+        const cSeparators*  mSeparators = nullptr;  // for split arrays
+    };
+
+    struct cArgsSpec
+    {
+        tArgVector<cArgInfo> mArguments; // Arguments
+        tArgString       mDescription;   // What they do
+    };
+
+    struct cOptionsSpec : public cArgsSpec
+    {
+        tArgString       mName;          // Name of option (-mName)
+        uint32_t         mNameHash;      // FoldedHash() of mName
+        int              mFlagToSet;     // if +ve, set this flag if we see this argument
+        tArgString       mEnvVar;        // environment variable supplying a default, if any
+    };
+
+    // Argument types. Each parses a single value of its type, either from
+    // argv, or from a range within a split array, and is used to instantiate
+    // the converters in cArgSpec::Internal.
+    typedef struct { float _[2]; } Vec2;
+    typedef struct { float _[3]; } Vec3;
+    typedef struct { float _[4]; } Vec4;
+
+    template<class T> tArgError ParseSplitValues(const cArgInfo& info, vector<typename T::tValue>* values, cSplitScanner* scanner, const char** token, const char** tokenEnd)
+    {
+        typename T::tValue value;
+
+        while (scanner->Next(token, tokenEnd))
+        {
+            tArgError error = T::Parse(info, &value, *token, *tokenEnd);
+
+            if (error != kArgNoError)
+                return error;
+
+            if (values)
+                values->push_back(value);
+        }
+
+        return kArgNoError;
+    }
+
+    template<class T> struct cValueArg
+    {
+        typedef T tValue;
+        enum { kArgsPerValue = 1, kSplitCopy = 0 };
+
+        static tArgError Parse(const cArgInfo&, T* value, const char**& argv, const char**)
+        { return AS::Parse(value, *argv++); }
+
+        static tArgError Parse(const cArgInfo&, T* value, const char* s, const char* end)
+        { return AS::Parse(value, s, end); }
+
+        static tArgError ParseSplit(const cArgInfo& info, vector<T>* values, cSplitScanner* scanner, const char** token, const char** tokenEnd)
+        { return ParseSplitValues<cValueArg>(info, values, scanner, token, tokenEnd); }
+    };
+
+    struct cEnumArg
+    {
+        typedef int tValue;
+        enum { kArgsPerValue = 1, kSplitCopy = 0 };
+
+        static tArgError Parse(const cArgInfo& info, int* value, const char**& argv, const char**)
+        { return AS::Parse(value, *info.mEnumSpec, *argv++); }
+
+        static tArgError Parse(const cArgInfo& info, int* value, const char* s, const char* end)
+        { return AS::Parse(value, *info.mEnumSpec, s, end); }
+
+        static tArgError ParseSplit(const cArgInfo& info, vector<int>* values, cSplitScanner* scanner, const char** token, const char** tokenEnd)
+        { return ParseSplitValues<cEnumArg>(info, values, scanner, token, tokenEnd); }
+    };
+
+    struct cCStringArg
+    {
+        typedef const char* tValue;
+        enum { kArgsPerValue = 1, kSplitCopy = 1 };     // elements must be NUL-terminated and outlive the call
+
+        static tArgError Parse(const cArgInfo&, const char** value, const char**& argv, const char**)
+        { return AS::Parse(value, *argv++); }
+
+        static tArgError ParseSplit(const cArgInfo&, vector<const char*>* values, cSplitScanner* scanner, const char** token, const char** tokenEnd)
+        {
+            while (scanner->Next(token, tokenEnd))
+            {
+                const_cast<char*>(*tokenEnd)[0] = 0;    // the scanner has already classified this separator
+
+                if (values)
+                    values->push_back(*token);
+            }
+
+            return kArgNoError;
+        }
+    };
+
+    template<class T> struct cVecArg
+    {
+        typedef T tValue;
+        enum { kArgsPerValue = sizeof(T) / sizeof(float), kSplitCopy = 0 };
+
+        static tArgError Parse(const cArgInfo&, T* value, const char**& argv, const char** argvEnd)
+        { return AS::Parse(kArgsPerValue, value->_, argv, argvEnd); }
+
+        static tArgError ParseSplit(const cArgInfo&, vector<T>* values, cSplitScanner* scanner, const char** token, const char** tokenEnd)
+        // As for Parse(int n, float v[], ...), each group of up to n elements forms a vector.
+        {
+            const int n = kArgsPerValue;
+
+            while (true)
+            {
+                T result;
+                int i = 0;
+
+                for ( ; i < n && scanner->Next(token, tokenEnd); i++)
+                {
+                    tArgError error = AS::Parse(result._ + i, *token, *tokenEnd);
+
+                    if (error != kArgNoError)
+                        return error;
+                }
+
+                if (i == 0)
+                    return kArgNoError;
+
+                for (int j = i; j < n; j++)
+                    result._[j] = (i == 1) ? result._[0] : 0.0f;
+
+                if (values)
+                    values->push_back(result);
+            }
+        }
+    };
+
+
+    // Sources of ConstructSpec() arguments
+    struct cVaArgSource
+    {
+        va_list mArgs;
+        bool    mMismatch = false;      // never set, as we can't check
+
+        cVaArgSource(va_list args)  { va_copy(mArgs, args); }
+        ~cVaArgSource()             { va_end(mArgs); }
+
+        const char*         String()    { return va_arg(mArgs, const char*); }
+        int                 Value()     { return va_arg(mArgs, int); }
+        const cArgEnumInfo* EnumInfo()  { return va_arg(mArgs, const cArgEnumInfo*); }
+
+        void* Variable(tSpecItemType* type)
+        {
+            *type = kItemUnknownPtr;
+            return va_arg(mArgs, void*);
+        }
+    };
+
+    struct cItemSource
+    {
+        const cSpecItem* mItem;
+        const cSpecItem* mEnd;
+        bool             mMismatch = false;     // set if an item is of the wrong kind, or we ran out
+
+        cItemSource(const cSpecItem* items, int numItems) : mItem(items), mEnd(items + numItems) {}
+
+        cSpecItem Next()
+        {
+            return mItem < mEnd ? *mItem++ : cSpecItem();
+        }
+
+        static bool IsNull(const cSpecItem& item)
+        {
+            return item.mType == kItemNull || (item.mType == kItemValue && item.mValue == 0);   // allow 0 as a terminator
+        }
+
+        const char* String()
+        {
+            cSpecItem item = Next();
+
+            if (item.mType == kItemString)
+                return static_cast<const char*>(item.mPointer);
+
+            mMismatch |= !IsNull(item);
+            return nullptr;
+        }
+
+        int Value()
+        {
+            cSpecItem item = Next();
+            mMismatch |= (item.mType != kItemValue);
+            return item.mValue;
+        }
+
+        const cArgEnumInfo* EnumInfo()
+        {
+            cSpecItem item = Next();
+            mMismatch |= (item.mType != kItemEnumInfo);
+            return item.mType == kItemEnumInfo ? static_cast<const cArgEnumInfo*>(item.mPointer) : nullptr;
+        }
+
+        void* Variable(tSpecItemType* type)
+        {
+            cSpecItem item = Next();
+            *type = IsNull(item) ? kItemNull : item.mType;
+
+            if (*type == kItemEnd || *type == kItemString || *type == kItemValue || *type == kItemEnumInfo)
+            {
+                mMismatch = true;   // we're out of step with the spec
+                return nullptr;
+            }
+
+            return const_cast<void*>(item.mPointer);
+        }
+    };
+
+    tSpecItemType ItemTypeFromArgType(tArgType type)
+    // Returns the variable type expected for the given argument type
+    {
+        static const tSpecItemType kItemTypes[kTypeEnumBegin] =
+        {
+            kItemOther,
+            kItemBoolPtr,
+            kItemIntPtr,
+            kItemFloatPtr,
+            kItemDoublePtr,
+            kItemCStringPtr,
+            kItemStringPtr,
+            kItemFloat2Ptr,
+            kItemFloat3Ptr,
+            kItemFloat4Ptr,
+        };
+
+        uint32_t baseType = type & kTypeBaseMask;
+        tSpecItemType itemType = baseType >= kTypeEnumBegin ? kItemEnumPtr : kItemTypes[baseType];
+
+        if (type & (kTypeArrayListFlag | kTypeArraySplitFlag))
+            itemType = tSpecItemType(itemType | kItemVectorOf);
+
+        return itemType;
+    }
+}
+
+struct cArgSpec::Internal
+{
+    Internal(cArgAllocator* allocator) : mAllocator(allocator), mRefCount(1) { mSeparators.Set(kDefaultSeparators); }
+
+    cArgAllocator*       mAllocator;
+    std::atomic<int>     mRefCount;      // number of cArgSpecs sharing this
+    tArgString           mCommandName;
+    tArgString           mCommandDescription;
+    cArgsSpec            mMainArgs;
+    tArgVector<cOptionsSpec> mOptions;
+    cNameTable           mOptionTable;   // mOptions by name
+    cNameTable           mEnvTable;      // mOptions by mEnvVar
+    cPrefixTrie          mOptionTrie;    // mOptions by unique prefix
+    tArgVector<cEnumSpec> mEnumSpecs;
+    cNameTable           mEnumTable;     // mEnumSpecs by name
+    int                  mNumBindings = 0;
+    int                  mNumFlagWords = 0;     // enough for the highest flag in the spec
+    bool                 mTypeMismatch = false; // a variable didn't match the spec, so Parse() refuses it
+    cSeparators          mSeparators;    // for split array arguments
+    cMappedFile          mSpecFile;      // backing store for a spec loaded via LoadSpecFile()
+
+    struct cHelpCache
+    {
+        tHelpType mHelpType;
+        tArgString mCommandName;
+        tArgString mHelp;
+    };
+
+    struct cCompletionIndex
+    {
+        cSortedNames             mOptions;
+        tArgVector<cSortedNames> mEnums;    // tokens, by mEnumSpecs index
+    };
+
+    mutable std::mutex   mHelpMutex;     // guards mHelpCache and mCompletionIndex, as help may be requested via concurrent Parse() calls
+    mutable tArgVector<std::unique_ptr<cHelpCache, cArgDeleter>> mHelpCache;   // rendered help, by type and command name
+    mutable std::unique_ptr<cCompletionIndex, cArgDeleter> mCompletionIndex;   // built by the first Complete()
+
+#if AS_INSTRUMENT
+    typedef std::chrono::steady_clock tClock;
+
+    struct cStats
+    // Parse instrumentation. Counters are relaxed atomics, so concurrent Parse() calls can update them
+    // cheaply, at the cost of a snapshot not being exactly consistent across counters.
+    {
+        std::atomic<bool>       mEnabled;
+        std::atomic<uint64_t>   mNumParses;
+        std::atomic<uint64_t>   mNumErrors;
+        std::atomic<uint64_t>   mNumTokens;
+        std::atomic<uint64_t>   mParseNS;
+        std::atomic<uint64_t>   mPhaseNS[kNumParsePhases];
+        tArgVector<std::atomic<uint64_t>> mOptionHits;     // sized ahead of mOptions
+
+        cStats() : mEnabled(false) { Reset(); }
+
+        bool Enabled() const { return mEnabled.load(std::memory_order_relaxed); }
+        static void Add(std::atomic<uint64_t>& counter, uint64_t n) { counter.fetch_add(n, std::memory_order_relaxed); }
+        static uint64_t NS(tClock::time_point start) { return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(tClock::now() - start).count()); }
+
+        void Reset();
+        void Reserve(size_t numOptions);
+    };
+
+    class cPhaseTimer
+    // Adds the time until it goes out of scope to the given phase, if stats are enabled.
+    {
+    public:
+        cPhaseTimer(cStats& stats, tParsePhase phase) :
+            mCounter(stats.Enabled() ? &stats.mPhaseNS[phase] : nullptr)
+        {
+            if (mCounter)
+                mStart = tClock::now();
+        }
+
+        ~cPhaseTimer()
+        {
+            if (mCounter)
+                cStats::Add(*mCounter, cStats::NS(mStart));
+        }
+
+    protected:
+        std::atomic<uint64_t>* mCounter;
+        tClock::time_point     mStart;
+    };
+
+    mutable cStats       mStats;
+#endif
+
+    // Utilities
+    template<class T_SOURCE> tArgSpecError ConstructSpec(const char* briefDescription, T_SOURCE* source);
+    template<class T_SOURCE> tArgSpecError AppendSpec(const char* spec, T_SOURCE* source);
+
+    void            Clear();
+    void            GetLocations(tArgVector<void*>* locations) const;
+    void            SaveSpec(vector<char>* data) const;
+    tArgSpecError   LoadSpec(const char* data, size_t size, void* const bindings[], int numBindings);
+
+    tArgError       Parse(cArgParseContext* context, int argc, const char** argv) const;
+    tArgError       ParseArgs(cArgParseContext* context, int argc, const char** argv) const;
+
+    template<class T_STRING> void CreateHelpString(const char* commandName, T_STRING* pString, tHelpType helpType) const;
+    void            WriteHelp(const char* commandName, cHelpOutput* out, tHelpType helpType) const;
+    const char*     CachedHelpString(const char* commandName, tHelpType helpType) const;
+    void            ClearHelpCache();
+    const cCompletionIndex& CompletionIndex() const;
+    int             Complete(int argc, const char** argv, int index, vector<string>* completions, string* hint) const;
+    void            CreateErrorString(const cArgParseContext& context, tArgString* pString) const;
+
+    tArgError       ParseArgument(cArgParseContext* context, const cArgInfo& info, const char**& argv, const char** argvEnd) const;
+
+    template<class T_ARG> static tArgError ConvertValue(cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd);
+    template<class T_ARG> static tArgError ConvertList (cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd);
+    template<class T_ARG> static tArgError ConvertSplit(cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd);
+    static tArgError ConvertInvalid(cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd);
+
+    template<class T_ARG> static tArgConverter Converter(tArgType type);
+    void            ResolveConverters();
+    void            ResolveConverters(tArgVector<cArgInfo>* args);
+
+    tArgError       ParseOptionArgs(cArgParseContext* context, const tArgVector<cArgInfo>& optArgs, const char**& argv, const char** argvEnd) const;
+    tArgError       ParseEnvironment(cArgParseContext* context) const;
+    tArgError       EnvironmentError(cArgParseContext* context) const;
+    tArgError       ParseEnvOption(cArgParseContext* context, int optionIndex, const char* value, cEnvIndex* index) const;
+    tArgError       ParseConfig(cArgParseContext* context) const;
+    tArgError       ParseOptionTokens(cArgParseContext* context, int optionIndex) const;
+    static bool     SplitsValue(const cOptionsSpec& option);
+    tArgError       ParseOption(cArgParseContext* context, const char**& argv, const char** argvEnd) const;
+    int             LookupOption(const char* name, size_t nameLength, bool exactOnly) const;
+
+    static tArgError SetError(cArgParseContext* context, tArgError error, const char** argv, int expected = 0);
+
+    struct cFileChain
+    {
+        const cMappedFile* mFile;
+        const cFileChain*  mParent;
+        int                mDepth;
+    };
+
+    static tArgError ExpandArg(cArgParseContext* context, const char* arg, const cFileChain* chain);
+
+    void            AddOption(cOptionsSpec&& option);
+    int             FindOption(const char* name, size_t nameLength) const;
+
+    void            GetStats(cArgParseStats* stats) const;
+    void            CreateStatsString(const char* commandName, tArgString* pString, tStatsFormat format) const;
+    cEnumSpec&      AddEnum(const char* name, const cArgEnumInfo* enumInfo);
+    void            NoteFlag(int flag) { if (flag >= 0) mNumFlagWords = std::max(mNumFlagWords, flag / 64 + 1); }
+    int             FindEnum(const char* name, size_t nameLength) const;
+
+    void            AddArgDocs(cHelpOutput* out, const tArgVector<cArgInfo>& args, tHelpType helpType) const;
+    void            FindNameAndTypeFromOption(const char* str, size_t length, tArgType* type, tArgString* name) const;
+    const char*     NameFromArgType(tArgType argType) const;
+    tArgType        ArgTypeFromName(const char* typeName, size_t typeLen) const;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Serialization
+//
+
+namespace
+{
+    const uint32_t kSpecFormatMagic   = 0x43505341;    // "ASPC"
+    const uint32_t kSpecFormatVersion = 5;
+    const size_t   kSpecHeaderSize    = 12;            // magic, version, checksum
+
+    // The serialized form is a stream of 32-bit words and strings, the latter
+    // stored as length + characters + NUL, padded to a word boundary. It holds
+    // no pointers, so can be loaded from anywhere.
+
+    uint32_t SpecChecksum(const char* s, size_t n)
+    // FNV-1a hash of the body following the header, so a truncated or
+    // corrupted file is rejected up front rather than trusted by the reader.
+    {
+        uint32_t hash = 2166136261u;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            hash ^= uint32_t((unsigned char) s[i]);
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+    struct cSpecWriter
+    {
+        vector<char>* mData;
+
+        void U32(uint32_t u)
+        {
+            const char* c = reinterpret_cast<const char*>(&u);
+            mData->insert(mData->end(), c, c + 4);
+        }
+
+        void I32(int i)
+        {
+            U32(uint32_t(i));
+        }
+
+        void String(const char* s, size_t length)
+        {
+            U32(uint32_t(length));
+            mData->insert(mData->end(), s, s + length);
+            mData->resize(mData->size() + 4 - (length & 3), 0);   // always at least one NUL
+        }
+
+        void String(const tArgString& s)
+        {
+            String(s.data(), s.size());
+        }
+
+        void Args(const tArgVector<cArgInfo>& args)
+        {
+            U32(uint32_t(args.size()));
+
+            for (const cArgInfo& arg : args)
+            {
+                U32(arg.mType);
+                String(arg.mName);
+                U32(arg.mIsRequired);
+                I32(arg.mFlagToSet);
+                I32(arg.mBinding);
+            }
+        }
+    };
+
+    struct cSpecReader
+    {
+        const char* mData;
+        const char* mEnd;
+        bool        mOK;
+
+        uint32_t U32()
+        {
+            uint32_t u = 0;
+
+            if (mEnd - mData >= 4)
+                memcpy(&u, mData, 4);
+            else
+                mOK = false;
+
+            mData += 4;
+            return u;
+        }
+
+        int I32()
+        {
+            return int(U32());
+        }
+
+        const char* String()
+        {
+            size_t length = U32();
+
+            if (!mOK || size_t(mEnd - mData) < length + 1 || mData[length] != 0)
+            {
+                mOK = false;
+                return "";
+            }
+
+            const char* result = mData;
+            mData += length + 4 - (length & 3);
+            return result;
+        }
+    };
+}
+
+void cArgSpec::Internal::SaveSpec(vector<char>* data) const
+{
+    cAllocScope scope(mAllocator);
+    cSpecWriter writer = { data };
+
+    data->clear();
+
+    writer.U32(kSpecFormatMagic);
+    writer.U32(kSpecFormatVersion);
+    writer.U32(0);                          // checksum, filled in below
+    writer.U32(mNumBindings);
+    writer.String(mCommandDescription);
+    writer.String(mSeparators.Chars());
+
+    writer.U32(uint32_t(mEnumSpecs.size()));
+
+    for (const cEnumSpec& enumSpec : mEnumSpecs)
+    {
+        writer.String(enumSpec.mName);
+        writer.String(enumSpec.mPath);     // dictionaries are re-read from their file
+
+        if (!enumSpec.mPath.empty())
+            continue;
+
+        writer.U32(uint32_t(enumSpec.mNumTokens));
+
+        for (const cArgEnumInfo* info = enumSpec.mEnumInfo; info && info->mToken; info++)
+        {
+            writer.String(info->mToken, strlen(info->mToken));
+            writer.I32(info->mValue);
+        }
+    }
+
+    writer.String(mMainArgs.mDescription);
+    writer.Args(mMainArgs.mArguments);
+
+    writer.U32(uint32_t(mOptions.size()));
+
+    for (const cOptionsSpec& option : mOptions)
+    {
+        writer.String(option.mName);
+        writer.I32(option.mFlagToSet);
+        writer.String(option.mEnvVar);
+        writer.String(option.mDescription);
+        writer.Args(option.mArguments);
+    }
+
+    uint32_t checksum = SpecChecksum(data->data() + kSpecHeaderSize, data->size() - kSpecHeaderSize);
+    memcpy(data->data() + kSpecHeaderSize - 4, &checksum, 4);
+}
+
+tArgSpecError cArgSpec::Internal::LoadSpec(const char* data, size_t size, void* const bindings[], int numBindings)
+{
+    cAllocScope scope(mAllocator);
+    cSpecReader reader = { data, data + size, true };
+
+    Clear();
+
+    if (size < kSpecHeaderSize || reader.U32() != kSpecFormatMagic || reader.U32() != kSpecFormatVersion)
+        return kSpecBadFormat;
+    if (reader.U32() != SpecChecksum(data + kSpecHeaderSize, size - kSpecHeaderSize))
+        return kSpecBadFormat;
+
+    mNumBindings = reader.I32();
+
+    if (mNumBindings > numBindings)
+        return kSpecBadBindings;
+
+    mCommandDescription = reader.String();
+    mSeparators.Set(reader.String());
+
+    uint32_t numEnums = reader.U32();
+
+    for (uint32_t i = 0; i < numEnums && reader.mOK; i++)
+    {
+        cEnumSpec& enumSpec = AddEnum(reader.String(), nullptr);
+        const char* path = reader.String();
+
+        if (path[0])
+        {
+            if (!enumSpec.Load(path))
+            {
+                Clear();
+                return kSpecBadEnumFile;
+            }
+
+            enumSpec.Index();
+            continue;
+        }
+
+        tArgVector<cArgEnumInfo>& store = enumSpec.mEnumInfoStore;
+        uint32_t numTokens = reader.U32();
+
+        for (uint32_t j = 0; j < numTokens && reader.mOK; j++)
+        {
+            const char* token = reader.String();    // tokens are referenced in place rather than copied
+            store.push_back( { token, reader.I32() } );
+        }
+
+        store.push_back( { nullptr, 0 } );
+        enumSpec.mEnumInfo = store.data();
+        enumSpec.Index();
+    }
+
+    auto readArgs = [&](tArgVector<cArgInfo>* args)
+    {
+        uint32_t numArgs = reader.U32();
+
+        for (uint32_t i = 0; i < numArgs && reader.mOK; i++)
+        {
+            cArgInfo info;
+
+            info.mType       = tArgType(reader.U32());
+            info.mName       = reader.String();
+            info.mIsRequired = reader.U32() != 0;
+            info.mFlagToSet  = reader.I32();
+            NoteFlag(info.mFlagToSet);
+            info.mBinding    = reader.I32();
+
+            uint32_t baseType = info.mType & kTypeBaseMask;
+
+            if (baseType >= kTypeEnumBegin && size_t(baseType - kTypeEnumBegin) >= mEnumSpecs.size())
+                reader.mOK = false;
+            if (info.mBinding < 0 || info.mBinding >= mNumBindings)
+                reader.mOK = false;
+            else
+                info.mLocation = bindings[info.mBinding];
+
+            args->push_back(info);
+        }
+    };
+
+    mMainArgs.mDescription = reader.String();
+    readArgs(&mMainArgs.mArguments);
+
+    uint32_t numOptions = reader.U32();
+
+    for (uint32_t i = 0; i < numOptions && reader.mOK; i++)
+    {
+        cOptionsSpec option;
+
+        option.mName         = reader.String();
+        option.mNameHash     = FoldedHash(option.mName.data(), option.mName.size());
+        option.mFlagToSet    = reader.I32();
+        NoteFlag(option.mFlagToSet);
+        option.mEnvVar       = reader.String();
+        option.mDescription  = reader.String();
+        readArgs(&option.mArguments);
+
+        AddOption(std::move(option));
+    }
+
+    if (!reader.mOK)
+    {
+        Clear();
+        return kSpecBadFormat;
+    }
+
+    ResolveConverters();
+    return kSpecNoError;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Instrumentation
+//
+
+#if AS_INSTRUMENT
+void cArgSpec::Internal::cStats::Reset()
+{
+    mNumParses = 0;
+    mNumErrors = 0;
+    mNumTokens = 0;
+    mParseNS = 0;
+
+    for (std::atomic<uint64_t>& phaseNS : mPhaseNS)
+        phaseNS = 0;
+
+    for (std::atomic<uint64_t>& hits : mOptionHits)
+        hits = 0;
+}
+
+void cArgSpec::Internal::cStats::Reserve(size_t numOptions)
+// Grow geometrically, as options are often appended one at a time
+{
+    size_t maxOptions = mOptionHits.size();
+
+    if (numOptions <= maxOptions)
+        return;
+
+    tArgVector<std::atomic<uint64_t>> optionHits(std::max(numOptions, 2 * maxOptions));
+
+    for (size_t i = 0; i < optionHits.size(); i++)
+        optionHits[i] = i < maxOptions ? mOptionHits[i].load() : 0;
+
+    mOptionHits.swap(optionHits);
+}
+#endif
+
+void cArgSpec::Internal::GetStats(cArgParseStats* stats) const
+{
+    *stats = cArgParseStats();
+
+#if AS_INSTRUMENT
+    const std::memory_order kRelaxed = std::memory_order_relaxed;
+
+    stats->mNumParses = mStats.mNumParses.load(kRelaxed);
+    stats->mNumErrors = mStats.mNumErrors.load(kRelaxed);
+    stats->mNumTokens = mStats.mNumTokens.load(kRelaxed);
+    stats->mParseNS   = mStats.mParseNS.load(kRelaxed);
+
+    for (int i = 0; i < kNumParsePhases; i++)
+        stats->mPhaseNS[i] = mStats.mPhaseNS[i].load(kRelaxed);
+
+    stats->mOptionHits.resize(mOptions.size());
+    stats->mOptionNames.resize(mOptions.size());
+
+    for (size_t i = 0; i < mOptions.size(); i++)
+    {
+        stats->mOptionHits[i] = mStats.mOptionHits[i].load(kRelaxed);
+        stats->mOptionNames[i].assign(mOptions[i].mName.data(), mOptions[i].mName.size());
+    }
+#endif
+}
+
+namespace
+{
+    const char* const kPhaseNames[kNumParsePhases] = { "response_files", "lookup", "convert", "arrays", "report" };
+
+    void AppendLabelValue(tArgString* s, const char* value)
+    // Prometheus label values escape backslash, double quote, and newline
+    {
+        for ( ; *value; value++)
+        {
+            if (*value == '\\' || *value == '"')
+                *s += '\\';
+
+            if (*value == '\n')
+                *s += "\\n";
+            else
+                *s += *value;
+        }
+    }
+
+    void AppendMetric(tArgString* s, const char* name, const char* help, const tArgString& labels, uint64_t value, bool header = true)
+    {
+        if (header)
+            SprintfAppend(s, "# HELP argspec_%s %s\n# TYPE argspec_%s counter\n", name, help, name);
+
+        SprintfAppend(s, "argspec_%s{%s} %llu\n", name, labels.c_str(), (unsigned long long) value);
+    }
+
+    void AppendMetricSeconds(tArgString* s, const char* name, const char* help, const tArgString& labels, uint64_t ns, bool header = true)
+    {
+        if (header)
+            SprintfAppend(s, "# HELP argspec_%s %s\n# TYPE argspec_%s counter\n", name, help, name);
+
+        SprintfAppend(s, "argspec_%s{%s} %.9f\n", name, labels.c_str(), ns * 1e-9);
+    }
+}
+
+void cArgSpec::Internal::CreateStatsString(const char* commandName, tArgString* pString, tStatsFormat format) const
+{
+    cAllocScope scope(mAllocator);
+
+    cArgParseStats stats;
+    GetStats(&stats);
+
+    pString->clear();
+
+    if (format == kStatsPrometheus)
+    {
+        tArgString labels = "command=\"";
+        AppendLabelValue(&labels, commandName);
+        labels += '"';
+
+        AppendMetric       (pString, "parses_total",        "Calls to Parse().",                        labels, stats.mNumParses);
+        AppendMetric       (pString, "parse_errors_total",  "Calls to Parse() that returned an error.", labels, stats.mNumErrors);
+        AppendMetric       (pString, "tokens_total",        "Arguments consumed by Parse().",           labels, stats.mNumTokens);
+        AppendMetricSeconds(pString, "parse_seconds_total", "Time spent in Parse().",                   labels, stats.mParseNS);
+
+        for (int i = 0; i < kNumParsePhases; i++)
+        {
+            tArgString phaseLabels = labels + ",phase=\"" + kPhaseNames[i] + '"';
+            AppendMetricSeconds(pString, "phase_seconds_total", "Time spent in each phase of parsing.", phaseLabels, stats.mPhaseNS[i], i == 0);
+        }
+
+        bool header = true;
+
+        for (size_t i = 0; i < stats.mOptionHits.size(); i++)
+        {
+            const string& name = stats.mOptionNames[i];
+
+            if (FindOption(name.data(), name.size()) != int(i))     // repeated name, never matched
+                continue;
+
+            tArgString optionLabels = labels + ",option=\"";
+            AppendLabelValue(&optionLabels, name.c_str());
+            optionLabels += '"';
+
+            AppendMetric(pString, "option_hits_total", "Times each option was given.", optionLabels, stats.mOptionHits[i], header);
+            header = false;
+        }
+
+        return;
+    }
+
+    Sprintf(pString, "%s: %llu parses, %llu errors, %llu tokens, %.3f ms\n", commandName,
+        (unsigned long long) stats.mNumParses, (unsigned long long) stats.mNumErrors,
+        (unsigned long long) stats.mNumTokens, stats.mParseNS * 1e-6);
+
+    for (int i = 0; i < kNumParsePhases; i++)
+        SprintfAppend(pString, "    %-20s %12.3f ms\n", kPhaseNames[i], stats.mPhaseNS[i] * 1e-6);
+
+    for (size_t i = 0; i < stats.mOptionHits.size(); i++)
+        SprintfAppend(pString, "    -%-19s %12llu\n", stats.mOptionNames[i].c_str(), (unsigned long long) stats.mOptionHits[i]);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgSpec
+//
+
+namespace
+{
+    template<class T, class... T_ARGS> T* NewInternal(cArgAllocator* allocator, T_ARGS&&... args)
+    // Creates T(allocator, args) with 'allocator' in scope, so its containers all pick it up
+    {
+        cAllocScope scope(allocator);
+        return NewArg<T>(allocator, allocator, std::forward<T_ARGS>(args)...);
+    }
+
+    template<class T> void ReleaseInternal(T* internal)
+    // Drops a reference to a shared spec, deleting it with the last one
+    {
+        if (internal && internal->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            DeleteArg(internal->mAllocator, internal);
+    }
+}
+
+cArgSpec::cArgSpec(cArgAllocator* allocator) :
+    _(NewInternal<Internal>(allocator)),
+    mContext(allocator),
+    mBindings(cArgAlloc<void*>(allocator))
+{
+}
+
+cArgSpec::cArgSpec(cArgSpec&& other) :
+    _(other._),
+    mContext(std::move(other.mContext)),
+    mBindings(std::move(other.mBindings))
+{
+    other._ = nullptr;
+}
+
+cArgSpec& cArgSpec::operator=(cArgSpec&& other)
+{
+    if (this != &other)
+    {
+        ReleaseInternal(_);
+        _ = other._;
+        other._ = nullptr;
+
+        mContext  = std::move(other.mContext);
+        mBindings = std::move(other.mBindings);
+    }
+
+    return *this;
+}
+
+cArgSpec::~cArgSpec()
+{
+    ReleaseInternal(_);
+}
+
+bool cArgSpec::Shared() const
+{
+    return _->mRefCount.load(std::memory_order_acquire) > 1 || !mBindings.empty();
+}
+
+void cArgSpec::Unshare()
+// Readies this copy for a new spec: if the current one is shared, we leave it to the others.
+{
+    if (_->mRefCount.load(std::memory_order_acquire) > 1)
+    {
+        ReleaseInternal(_);
+        _ = NewInternal<Internal>(mContext.mAllocator);
+    }
+
+    mBindings.clear();
+    mContext.Bind(nullptr, 0);
+    mContext.mErrorString.clear();
+    mContext.mErrorStringValid = true;
+}
+
+tArgSpecError cArgSpec::ConstructSpecItems(const char* briefDescription, const cSpecItem items[], int numItems)
+{
+    Unshare();
+
+    cItemSource source(items, numItems);
+    return _->ConstructSpec(briefDescription, &source);
+}
+
+tArgSpecError cArgSpec::AppendSpecItems(const cSpecItem items[], int numItems)
+{
+    if (Shared())
+        return kSpecShared;
+
+    cItemSource source(items, numItems);
+    return _->AppendSpec(source.String(), &source);
+}
+
+tArgSpecError cArgSpec::ConstructSpecV(const char* briefDescription, va_list args)
+{
+    Unshare();
+
+    cVaArgSource source(args);
+    return _->ConstructSpec(briefDescription, &source);
+}
+
+tArgSpecError cArgSpec::AppendSpecV(const char* spec, va_list args)
+{
+    if (Shared())
+        return kSpecShared;
+
+    cVaArgSource source(args);
+    return _->AppendSpec(spec, &source);
+}
+
+void cArgSpec::SaveSpec(vector<char>* data) const
+{
+    _->SaveSpec(data);
+}
+
+tArgSpecError cArgSpec::LoadSpec(const void* data, size_t size, void* const bindings[], int numBindings)
+{
+    Unshare();
+    return _->LoadSpec(static_cast<const char*>(data), size, bindings, numBindings);
+}
+
+tArgSpecError cArgSpec::LoadSpecFile(const char* path, void* const bindings[], int numBindings)
+{
+    Unshare();
+
+    cAllocScope scope(_->mAllocator);
+    cMappedFile file;
+
+    if (!file.Open(path))
+        return kSpecBadFormat;
+
+    tArgSpecError err = _->LoadSpec(file.mData, file.mSize, bindings, numBindings);
+
+    if (err == kSpecNoError)    // enum tokens point into the file, so keep it around
+        _->mSpecFile.Swap(file);
+
+    return err;
+}
+
+int cArgSpec::NumBindings() const
+{
+    return _->mNumBindings;
+}
+
+tArgSpecError cArgSpec::Clone(const cArgSpec& spec, void* const bindings[], int numBindings)
+{
+    if (bindings && numBindings < spec._->mNumBindings)
+        return kSpecBadBindings;
+
+    spec._->mRefCount.fetch_add(1, std::memory_order_relaxed);     // before releasing ours, in case they're the same
+    ReleaseInternal(_);
+    _ = spec._;
+
+    if (bindings)
+        mBindings.assign(bindings, bindings + numBindings);
+    else if (&spec != this)
+        mBindings = spec.mBindings;
+
+    mContext.Bind(mBindings.empty() ? nullptr : mBindings.data(), int(mBindings.size()));
+    mContext.mErrorString.clear();
+    mContext.mErrorStringValid = true;
+
+    return kSpecNoError;
+}
+
+tArgSpecError cArgSpec::Clone(const cArgSpec& spec, const void* fromObject, void* toObject, size_t objectSize)
+{
+    tArgVector<void*> bindings(cArgAlloc<void*>(mContext.mAllocator));
+
+    if (spec.mBindings.empty())
+        spec._->GetLocations(&bindings);
+    else
+        bindings.assign(spec.mBindings.begin(), spec.mBindings.end());
+
+    uintptr_t from = uintptr_t(fromObject);
+    uintptr_t to   = uintptr_t(toObject);
+
+    for (void*& location : bindings)
+        if (uintptr_t(location) - from < objectSize)
+            location = reinterpret_cast<void*>(uintptr_t(location) - from + to);
+
+    return Clone(spec, bindings.data(), int(bindings.size()));
+}
+
+void cArgSpec::SetArraySeparators(const char* separators)
+{
+    AS_ASSERT(!Shared());
+
+    if (!Shared())
+        _->mSeparators.Set(separators);
+}
+
+tArgError cArgSpec::Parse(int argc, const char** argv)
+{
+    return _->Parse(&mContext, argc, argv);
+}
+
+void cArgSpec::SetEnvironment(bool enabled)
+{
+    mContext.SetEnvironment(enabled);
+}
+
+void cArgSpec::SetConfigFile(const char* path)
+{
+    mContext.SetConfigFile(path);
+}
+
+tArgError cArgSpec::Parse(int argc, const char** argv, cArgParseContext* context) const
+{
+    return _->Parse(context, argc, argv);
+}
+
+bool AS::cArgSpec::Flag(int flag) const
+{
+    return mContext.Flag(flag);
+}
+
+void AS::cArgSpec::SetFlag(int flag)
+{
+    mContext.SetFlag(flag);
+}
+
+bool AS::cArgSpec::AnyFlags(const uint64_t mask[], int numWords) const
+{
+    return mContext.AnyFlags(mask, numWords);
+}
+
+const uint64_t* AS::cArgSpec::FlagWords(int* numWords) const
+{
+    return mContext.FlagWords(numWords);
+}
+
+void cArgSpec::CreateHelpString(const char* commandName, string* pString, tHelpType helpType) const
+{
+    _->CreateHelpString(commandName, pString, helpType);
+}
+
+void cArgSpec::WriteHelp(const char* commandName, tHelpType helpType, tHelpWriter* writer, void* userData) const
+{
+    cHelpOutput out(writer, userData);
+    _->WriteHelp(commandName ? commandName : "", &out, helpType);
+}
+
+namespace
+{
+    void WriteToFile(void* userData, const char* data, size_t size)
+    {
+        fwrite(data, 1, size, static_cast<FILE*>(userData));
+    }
+
+#ifndef _WIN32
+    void WriteToFD(void* userData, const char* data, size_t size)
+    {
+        int fd = int(reinterpret_cast<intptr_t>(userData));
+
+        while (size > 0)
+        {
+            ssize_t written = write(fd, data, size);
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                return;
+            }
+
+            data += written;
+            size -= size_t(written);
+        }
+    }
+#endif
+}
+
+void cArgSpec::WriteHelp(const char* commandName, tHelpType helpType, FILE* file) const
+{
+    WriteHelp(commandName, helpType, WriteToFile, file);
+}
+
+#ifndef _WIN32
+void cArgSpec::WriteHelp(const char* commandName, tHelpType helpType, int fd) const
+{
+    WriteHelp(commandName, helpType, WriteToFD, reinterpret_cast<void*>(intptr_t(fd)));
+}
+#endif
+
+const char* cArgSpec::HelpString(const char* commandName, tHelpType helpType) const
+{
+    return _->CachedHelpString(commandName, helpType);
+}
+
+int cArgSpec::Complete(int argc, const char** argv, int index, vector<string>* completions, string* hint) const
+{
+    return _->Complete(argc, argv, index, completions, hint);
+}
+
+bool cArgSpec::WriteCompletions(int argc, const char** argv, FILE* file) const
+{
+    if (argc < 3 || strcmp(argv[1], kCompleteOption) != 0)
+        return false;
+
+    // The index comes from the shell, but check it anyway rather than trust atoi()
+    const char* indexString = argv[2];
+    const char* indexEnd = indexString + strlen(indexString);
+    int64_t index = 0;
+
+    if (ScanInt(indexString, indexEnd, 0, INT_MAX, &index) != kArgNoError || indexString != indexEnd)
+        return true;    // no completions
+
+    vector<string> completions;
+    string hint;
+
+    _->Complete(argc - 3, argv + 3, int(index), &completions, &hint);
+
+    for (const string& completion : completions)
+        fprintf(file, "%s\n", completion.c_str());
+
+    if (!hint.empty())
+        fprintf(file, "%s\n", hint.c_str());
+
+    return true;
+}
+
+void cArgSpec::CreateCompletionScript(const char* commandName, string* script, tCompletionShell shell) const
+{
+    // Function names can't contain all the characters a command name might
+    string function = "_";
+
+    for (const char* s = commandName; *s; s++)
+        function += isalnum((unsigned char) *s) ? *s : '_';
+
+    function += "_complete";
+
+    // Built by appending, as commandName may be of any length. Hints start with '<', and are shown rather
+    // than inserted where the shell allows.
+    script->clear();
+
+    if (shell == kShellZsh)
+    {
+        *script += "#compdef ";
+        *script += commandName;
+        *script += "\n";
+        *script += function;
+        *script +=
+            "()\n"
+            "{\n"
+            "    local -a completions hints\n"
+            "    local line\n"
+            "    for line in \"${(@f)$(\"${words[1]}\" ";
+        *script += kCompleteOption;
+        *script +=
+            " $((CURRENT - 1)) \"${words[@]}\" 2>/dev/null)}\"; do\n"
+            "        if [[ $line == \\<* ]]; then hints+=(\"$line\"); elif [[ -n $line ]]; then completions+=(\"$line\"); fi\n"
+            "    done\n"
+            "    (( ${#hints} )) && _message -r \"${hints[1]}\"\n"
+            "    (( ${#completions} )) && compadd -Q -a completions\n"
+            "}\n"
+            "compdef ";
+    }
+    else
+    {
+        *script += function;
+        *script +=
+            "()\n"
+            "{\n"
+            "    local IFS=$'\\n' line\n"
+            "    COMPREPLY=()\n"
+            "    for line in $(\"${COMP_WORDS[0]}\" ";
+        *script += kCompleteOption;
+        *script +=
+            " \"$COMP_CWORD\" \"${COMP_WORDS[@]}\" 2>/dev/null); do\n"
+            "        [[ $line == \\<* ]] || COMPREPLY+=(\"$line\")\n"
+            "    done\n"
+            "}\n"
+            "complete -o default -F ";
+    }
+
+    *script += function;
+    *script += " ";
+    *script += commandName;
+    *script += "\n";
+}
+
+const char* AS::cArgSpec::ErrorString()
+{
+    return ErrorString(&mContext);
+}
+
+const char* cArgSpec::ErrorString(cArgParseContext* context) const
+{
+    if (context->mError.mError == kArgHelpRequested)
+        return _->CachedHelpString(context->mArgv[0], kHelpFull);
+
+    if (!context->mErrorStringValid)
+    {
+        _->CreateErrorString(*context, &context->mErrorString);
+        context->mErrorStringValid = true;
+    }
+
+    return context->mErrorString.c_str();
+}
+
+const cArgErrorInfo& cArgSpec::ErrorInfo() const
+{
+    return mContext.mError;
+}
+
+bool cArgSpec::EnableStats(bool enabled)
+{
+#if AS_INSTRUMENT
+    _->mStats.mEnabled = enabled;
+    return true;
+#else
+    (void) enabled;
+    return false;
+#endif
+}
+
+void cArgSpec::GetStats(cArgParseStats* stats) const
+{
+    _->GetStats(stats);
+}
+
+void cArgSpec::ResetStats()
+{
+#if AS_INSTRUMENT
+    _->mStats.Reset();
+#endif
+}
+
+void cArgSpec::CreateStatsString(const char* commandName, string* pString, tStatsFormat format) const
+{
+    tArgString stats(cArgAlloc<char>(_->mAllocator));
+    _->CreateStatsString(commandName ? commandName : "", &stats, format);
+    pString->assign(stats.data(), stats.size());
+}
+
+bool cArgSpec::WriteStatsFile(const char* commandName, const char* path, tStatsFormat format) const
+{
+    cAllocScope scope(_->mAllocator);
+
+    tArgString stats;
+    _->CreateStatsString(commandName ? commandName : "", &stats, format);
+
+    tArgString tempPath = tArgString(path) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+
+    if (!file)
+        return false;
+
+    bool ok = fwrite(stats.data(), 1, stats.size(), file) == stats.size();
+    ok = (fclose(file) == 0) && ok;
+
+#ifdef _WIN32
+    if (ok)
+        remove(path);   // rename() won't replace an existing file
+#endif
+
+    if (!ok || rename(tempPath.c_str(), path) != 0)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgParseContext
+//
+
+bool cArgParseContext::Flag(int flag) const
+{
+    AS_ASSERT(flag >= 0);
+    size_t word = size_t(flag) / 64;
+
+    return word < mFlags.size() && (mFlags[word] >> (flag % 64) & 1) != 0;
+}
+
+void cArgParseContext::SetFlag(int flag)
+{
+    AS_ASSERT(flag >= 0);
+    size_t word = size_t(flag) / 64;
+
+    if (word >= mFlags.size())
+        mFlags.resize(word + 1, 0);
+
+    mFlags[word] |= uint64_t(1) << (flag % 64);
+}
+
+bool cArgParseContext::AnyFlags(const uint64_t mask[], int numWords) const
+{
+    int n = std::min(numWords, int(mFlags.size()));
+
+    for (int i = 0; i < n; i++)
+        if (mFlags[i] & mask[i])
+            return true;
+
+    return false;
+}
+
+const uint64_t* cArgParseContext::FlagWords(int* numWords) const
+{
+    *numWords = int(mFlags.size());
+    return mFlags.data();
+}
+
+const cArgErrorInfo& cArgParseContext::ErrorInfo() const
+{
+    return mError;
+}
+
+cArgParseContext::cArgParseContext(cArgAllocator* allocator) :
+    mAllocator(allocator),
+    mFlags(cArgAlloc<uint64_t>(allocator)),
+    mScratch(cArgAlloc<tArgVector<char>>(allocator)),
+    mArgs(cArgAlloc<const char*>(allocator)),
+    mFileTokens(cArgAlloc<const char*>(allocator)),
+    mFiles(cArgAlloc<void*>(allocator)),
+    mValueTokens(cArgAlloc<const char*>(allocator)),
+    mEnvErrors(cArgAlloc<int>(allocator)),
+    mConfigPath(cArgAlloc<char>(allocator)),
+    mErrorString(cArgAlloc<char>(allocator))
+{
+}
+
+cArgParseContext::cArgParseContext(cArgParseContext&& other) :
+    cArgParseContext(other.mAllocator)
+{
+    *this = std::move(other);
+}
+
+cArgParseContext& cArgParseContext::operator=(cArgParseContext&& other)
+{
+    if (this == &other)
+        return *this;
+
+    ReleaseFiles();
+
+    mAllocator          = other.mAllocator;
+    mFlags              = std::move(other.mFlags);
+    mHelpRequested      = other.mHelpRequested;
+    mResponseFiles      = other.mResponseFiles;
+    mEnvironment        = other.mEnvironment;
+    mError              = other.mError;
+    mArgc               = other.mArgc;
+    mArgv               = other.mArgv;      // may point into mArgs, whose storage moves with it
+    mBindings           = other.mBindings;
+    mNumBindings        = other.mNumBindings;
+    mScratch            = std::move(other.mScratch);
+    mArgs               = std::move(other.mArgs);
+    mFileTokens         = std::move(other.mFileTokens);
+    mFiles              = std::move(other.mFiles);
+    mValueTokens        = std::move(other.mValueTokens);    // likewise for mArgv after an environment or config error
+    mEnvVar             = other.mEnvVar;
+    mEnvErrors          = std::move(other.mEnvErrors);
+    mConfigPath         = std::move(other.mConfigPath);
+    mErrorString        = std::move(other.mErrorString);
+    mErrorStringValid   = other.mErrorStringValid;
+
+    other.mFiles.clear();   // now ours
+    other.mArgc = 0;
+    other.mArgv = nullptr;
+
+    return *this;
+}
+
+cArgParseContext::~cArgParseContext()
+{
+    ReleaseFiles();
+}
+
+void cArgParseContext::ReleaseFiles()
+{
+    for (void* file : mFiles)
+        DeleteArg(mAllocator, static_cast<cMappedFile*>(file));
+
+    mFiles.clear();
+    mFileTokens.clear();
+}
+
+void cArgParseContext::Bind(void* const bindings[], int numBindings)
+{
+    mBindings = bindings;
+    mNumBindings = numBindings;
+}
+
+void cArgParseContext::SetResponseFiles(bool enabled)
+{
+    mResponseFiles = enabled;
+}
+
+void cArgParseContext::SetEnvironment(bool enabled)
+{
+    mEnvironment = enabled;
+}
+
+void cArgParseContext::SetConfigFile(const char* path)
+{
+    cAllocScope scope(mAllocator);
+    mConfigPath = path ? path : "";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgSpec::Internal implementation
+//
+
+void cArgSpec::Internal::Clear()
+{
+    mCommandDescription.clear();
+    mMainArgs.mDescription.clear();
+    mMainArgs.mArguments.clear();
+    mOptions.clear();
+    mOptionTable.Clear();
+    mEnvTable.Clear();
+    mOptionTrie.Clear();
+    mEnumSpecs.clear();
+    mEnumTable.Clear();
+    mNumFlagWords = 0;
+    mNumBindings = 0;
+    mTypeMismatch = false;
+    mSpecFile.Close();
+    ClearHelpCache();
+#if AS_INSTRUMENT
+    mStats.Reset();     // option indices are about to change
+#endif
+}
+
+void cArgSpec::Internal::GetLocations(tArgVector<void*>* locations) const
+// The variables bound by the spec itself, indexed by binding
+{
+    locations->assign(size_t(mNumBindings), nullptr);
+
+    for (const cArgInfo& info : mMainArgs.mArguments)
+        (*locations)[info.mBinding] = info.mLocation;
+
+    for (const cOptionsSpec& option : mOptions)
+        for (const cArgInfo& info : option.mArguments)
+            (*locations)[info.mBinding] = info.mLocation;
+}
+
+template<class T_SOURCE> tArgSpecError cArgSpec::Internal::ConstructSpec(const char* description, T_SOURCE* source)
+{
+    Clear();
+    mCommandDescription = description;
+
+    return AppendSpec(source->String(), source);
+}
+
+template<class T_SOURCE> tArgSpecError cArgSpec::Internal::AppendSpec(const char* optionCStr, T_SOURCE* source)
+{
+    cAllocScope scope(mAllocator);
+
+    tArgSpecError err = kSpecNoError;
+    tArgVector<tSpecItemType> itemTypes;
+
+    for ( ; optionCStr; optionCStr = source->String())
+    {
+        // A single forward pass over the spec, with tokens viewing it in place
+        const char* options = optionCStr;
+        cSpecToken nextToken;
+
+        // is this an enum specification? (:enumName, =enumName, or @enumName)
+        if (options[0] == kEnumSpecChar || options[0] == kEnumSpecInlineChar || options[0] == kEnumSpecFileChar)
+        {
+            if (options[0] == kEnumSpecChar)
+                AddEnum(options + 1, source->EnumInfo());
+            else if (options[0] == kEnumSpecFileChar)
+            {
+                const char* path = source->String();
+
+                if (!AddEnum(options + 1, nullptr).Load(path ? path : ""))
+                    err = kSpecBadEnumFile;     // carry on with an empty enum
+            }
+            else
+            {
+                cEnumSpec& enumSpec = AddEnum(options + 1, nullptr);
+
+                while (true)
+                {
+                    const char* enumToken = source->String();
+                    if (!enumToken)
+                        break;
+
+                    int enumValue = source->Value();
+                    enumSpec.mEnumInfoStore.push_back( { enumToken, enumValue } );
+                }
+
+                enumSpec.mEnumInfoStore.push_back( { nullptr, 0 } );
+                enumSpec.mEnumInfo = enumSpec.mEnumInfoStore.data();
+            }
+
+            if (source->mMismatch)
+            {
+                err = kSpecTypeMismatch;
+                mTypeMismatch = true;
+                break;
+            }
+
+            mEnumSpecs.back().Index();
+            continue;
+        }
+
+        nextToken = NextSpecToken(options);
+
+        tArgVector<cArgInfo>* argsToAddTo = 0;
+        cOptionsSpec newOption;
+
+        // is it an option, or should it be added to the default arguments?
+        bool isOption = IsOption(nextToken.mBegin);    // safe to peek at mBegin[1], as the spec is NUL-terminated
+
+        if (isOption)
+        {
+            if (nextToken.Back() == kSetFlagChar)
+            {
+                nextToken.mEnd--;
+                newOption.mFlagToSet = source->Value();
+                NoteFlag(newOption.mFlagToSet);
+            }
+            else
+                newOption.mFlagToSet = -1;
+
+            newOption.mName.assign(nextToken.mBegin + 1, nextToken.mEnd);
+            newOption.mNameHash = FoldedHash(newOption.mName.data(), newOption.mName.size());
+
+            nextToken = NextSpecToken(options);
+
+            if (!nextToken.Empty() && nextToken.Front() == kEnvVarChar)
+            {
+                if (nextToken.Size() > 1 && std::all_of(nextToken.mBegin + 1, nextToken.mEnd, [](char c) { return c == '_' || isalnum((unsigned char) c); }))
+                    newOption.mEnvVar.assign(nextToken.mBegin + 1, nextToken.mEnd);
+                else
+                    err = kSpecBadEnvVar;   // register error but carry on, as for unknown types
+
+                nextToken = NextSpecToken(options);
+            }
+            argsToAddTo = &newOption.mArguments;
+        }
+        else
+            argsToAddTo = &mMainArgs.mArguments;
+
+        int optionLevel = 0;
+        int lastOptionLevel = 0;
+        size_t firstArg = argsToAddTo->size();
+        itemTypes.clear();
+
+        while (!nextToken.Empty())
+        {
+            cArgInfo newArgInfo;
+
+            if (nextToken.Front() == kOpenBracketChar)
+            {
+                optionLevel++;
+                nextToken.mBegin++;
+            }
+
+            newArgInfo.mIsRequired = (optionLevel == lastOptionLevel);
+
+            while (!nextToken.Empty() && nextToken.Back() == kCloseBracketChar)
+            {
+                optionLevel--;
+                nextToken.mEnd--;
+            }
+
+            if (nextToken.Is(kEllipsisToken))
+            {
+                if (!NextSpecToken(options).Empty())
+                    return kSpecEllipsisError;
+                if (argsToAddTo->empty())
+                    return kSpecEllipsisError;
+
+                argsToAddTo->back().mType = argsToAddTo->back().mType | kTypeArrayListFlag;
+                nextToken = NextSpecToken(options);
+                continue;
+            }
+
+            // fetch var args: location and optionally flag
+            tSpecItemType itemType;
+            newArgInfo.mLocation    = source->Variable(&itemType);
+            newArgInfo.mBinding     = mNumBindings++;
+            itemTypes.push_back(itemType);
+
+            if (!nextToken.Empty() && nextToken.Back() == kSetFlagChar)
+            {
+                nextToken.mEnd--;
+                newArgInfo.mFlagToSet = source->Value();
+                NoteFlag(newArgInfo.mFlagToSet);
+            }
+            else
+                newArgInfo.mFlagToSet = -1;
+
+            FindNameAndTypeFromOption(nextToken.mBegin, nextToken.Size(), &newArgInfo.mType, &newArgInfo.mName);
+
+            if (newArgInfo.mType == kTypeInvalid)
+                err = kSpecUnknownType; // register error but carry on; we can mostly survive this.
+
+            argsToAddTo->push_back(std::move(newArgInfo));
+
+            lastOptionLevel = optionLevel;
+            nextToken = NextSpecToken(options);
+        }
+
+        if (optionLevel != 0)
+        {
+            err = kSpecUnbalancedBrackets;
+            break;
+        }
+
+        // check variable types now any '...' has been applied
+        for (size_t i = 0; i < itemTypes.size(); i++)
+        {
+            cArgInfo& info = (*argsToAddTo)[firstArg + i];
+
+            if (info.mType != kTypeInvalid && !Check::ItemMatches(ItemTypeFromArgType(info.mType), itemTypes[i]))
+            {
+                info.mLocation = nullptr;   // never write the wrong type, even if Parse() is called regardless
+                err = kSpecTypeMismatch;
+                mTypeMismatch = true;
+            }
+        }
+
+        const char* docCString = source->String();
+
+        if (source->mMismatch)
+        {
+            err = kSpecTypeMismatch;
+            mTypeMismatch = true;
+            break;
+        }
+
+        AS_ASSERT_F(docCString && strlen(docCString) < 500, "Bad argument spec around '%s'\n", optionCStr);   // often we'll crash here if the spec is confused.
+
+        if (isOption)
+        {
+            newOption.mDescription = docCString;
+            AddOption(std::move(newOption));
+        }
+        else
+            mMainArgs.mDescription += docCString;
+    }
+
+    ResolveConverters();
+    ClearHelpCache();
+    return err;
+}
+
+tArgError cArgSpec::Internal::Parse(cArgParseContext* context, int argc, const char** argv) const
+{
+    cAllocScope scope(context->mAllocator);     // for per-call state, e.g., @file buffers
+
+#if AS_INSTRUMENT
+    if (mStats.Enabled())
+    {
+        tClock::time_point start = tClock::now();
+        tArgError error = ParseArgs(context, argc, argv);
+
+        cStats::Add(mStats.mParseNS, cStats::NS(start));
+        cStats::Add(mStats.mNumParses, 1);
+
+        if (error != kArgNoError && error != kArgHelpRequested)
+            cStats::Add(mStats.mNumErrors, 1);
+
+        int numTokens = (error == kArgNoError ? context->mArgc : context->mError.mArgIndex) - 1;   // minus argv[0]
+
+        if (numTokens > 0)
+            cStats::Add(mStats.mNumTokens, uint64_t(numTokens));
+
+        return error;
+    }
+#endif
+
+    return ParseArgs(context, argc, argv);
+}
+
+tArgError cArgSpec::Internal::ParseArgs(cArgParseContext* context, int argc, const char** argv) const
+{
+    // clear state
+    context->mFlags.assign(mNumFlagWords, 0);
+    context->mHelpRequested = false;
+    context->mError = cArgErrorInfo();
+    context->mErrorStringValid = false;
+    context->mArgc = argc;
+    context->mArgv = argv;
+    context->mEnvVar = nullptr;
+    context->mEnvErrors.clear();
+    context->mScratch.clear();
+
+    AS_ASSERT(!context->mBindings || context->mNumBindings >= mNumBindings);
+
+    if (mTypeMismatch)
+        return SetError(context, kArgErrorBadSpec, argv);
+
+    // expand any @file arguments
+    context->ReleaseFiles();
+
+    for (int j = 1; j < argc && context->mResponseFiles; j++)
+    {
+        if (IsResponseFile(argv[j]))
+        {
+        #if AS_INSTRUMENT
+            cPhaseTimer timer(mStats, kPhaseResponseFiles);
+        #endif
+            tArgError error = kArgNoError;
+
+            context->mArgs.assign(argv, argv + j);
+
+            for ( ; j < argc && error == kArgNoError; j++)
+                error = ExpandArg(context, argv[j], nullptr);
+
+            argc = int(context->mArgs.size());
+            argv = context->mArgs.data();
+            context->mArgc = argc;
+            context->mArgv = argv;
+
+            if (error != kArgNoError)
+                return SetError(context, error, argv + argc - 1);
+
+            break;
+        }
+    }
+
+    // chomp name.
+    const char** argvEnd = argv + argc;
+    argv++;
+
+    // if they've supplied nothing at all, just show them the help
+    if (argc == 1 && !mMainArgs.mArguments.empty())
+        return SetError(context, kArgHelpRequested, argv);
+
+    // apply any config file, then the environment, so the command line overrides both
+    tArgError error = context->mConfigPath.empty() ? kArgNoError : ParseConfig(context);
+
+    if (error == kArgNoError && context->mEnvironment)
+        error = ParseEnvironment(context);
+    if (error != kArgNoError)
+        return error;
+
+    size_t i = 0;
+    size_t n = mMainArgs.mArguments.size();
+
+    while (argv < argvEnd)
+    {
+        if (IsOption(*argv))
+        {
+            error = ParseOption(context, argv, argvEnd);
+
+            if (error != kArgNoError)
+                return error;
+        }
+        else if (i < n)
+        {
+            error = ParseArgument(context, mMainArgs.mArguments[i], argv, argvEnd);
+
+            if (error != kArgNoError)
+            {
+                context->mError.mType = mMainArgs.mArguments[i].mType;
+                return SetError(context, error, argv - 1);
+            }
+
+            i++;
+        }
+        else
+            return SetError(context, kArgErrorTooManyArgs, argv, int(n));
+    }
+
+    if (!context->mEnvErrors.empty())
+        return EnvironmentError(context);
+
+    if (!context->mHelpRequested && i < n && mMainArgs.mArguments[i].mIsRequired)
+    {
+        size_t numHave = i;
+
+        do
+            i++;
+        while (i < n && mMainArgs.mArguments[i].mIsRequired);
+
+        return SetError(context, kArgErrorNotEnoughArgs, argv, int(i - numHave));
+    }
+
+    return kArgNoError;
+}
+
+const char* cArgSpec::Internal::CachedHelpString(const char* commandName, tHelpType helpType) const
+// Help is rendered once per type and command name, and then returned as is until the spec changes.
+{
+    if (!commandName)
+        commandName = "";
+
+    std::lock_guard<std::mutex> lock(mHelpMutex);
+
+    for (const std::unique_ptr<cHelpCache, cArgDeleter>& entry : mHelpCache)
+        if (entry->mHelpType == helpType && entry->mCommandName == commandName)
+            return entry->mHelp.c_str();
+
+    cAllocScope scope(mAllocator);
+    mHelpCache.push_back(std::unique_ptr<cHelpCache, cArgDeleter>(NewArg<cHelpCache>(mAllocator), cArgDeleter { mAllocator }));
+
+    cHelpCache* entry = mHelpCache.back().get();
+    entry->mHelpType = helpType;
+    entry->mCommandName = commandName;
+
+    CreateHelpString(commandName, &entry->mHelp, helpType);
+    return entry->mHelp.c_str();
+}
+
+void cArgSpec::Internal::ClearHelpCache()
+{
+    std::lock_guard<std::mutex> lock(mHelpMutex);
+    mHelpCache.clear();
+    mCompletionIndex.reset();
+}
+
+template<class T_STRING> void cArgSpec::Internal::CreateHelpString(const char* commandName, T_STRING* helpString, tHelpType helpType) const
+{
+    if (helpType == kHelpBrief)
+        helpString->clear();
+
+    cHelpOutput out(AppendToString<T_STRING>, helpString);
+    WriteHelp(commandName, &out, helpType);
+}
+
+void cArgSpec::Internal::WriteHelp(const char* commandName, cHelpOutput* out, tHelpType helpType) const
+{
+#if AS_INSTRUMENT
+    cPhaseTimer timer(mStats, kPhaseReport);
+#endif
+    cAllocScope scope(mAllocator);
+
+    if (helpType == kHelpBrief)
+    {
+        out->Put(commandName);
+        out->Put(", ");
+        out->Put(mCommandDescription);
+        return;
+    }
+
+    if (helpType == kHelpHTML)
+    {
+        out->Put("<tr><td><a name=\"");    // start frame
+        out->Put(commandName);
+        out->Put("\"></a>");
+        out->Put("<p>");
+        out->Put(mCommandDescription);
+        out->Put("</p>\n\n");
+        out->Put("<p><h3>Usage</h3></p>\n");
+
+        out->Put("<b>");
+        out->Put(commandName);
+        out->Put("</b> ");
+
+        if (!mOptions.empty())
+            out->Put("[options] ");
+
+        AddArgDocs(out, mMainArgs.mArguments, helpType);
+
+        out->Put("<br><blockquote><p>");
+        AddDocString(out, "", mMainArgs.mDescription);
+        out->Put("</blockquote>\n");
+
+        if (!mOptions.empty())
+        {
+            out->Put("<p><h3>Options</h3></p>\n");
+
+            for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+            {
+                out->Put("<b>-");
+                out->Put(mOptions[j].mName);
+                out->Put("</b> ");
+                AddArgDocs(out, mOptions[j].mArguments, helpType);
+                out->Put("<br><blockquote>");
+                AddDocString(out, "", mOptions[j].mDescription);
+
+                if (!mOptions[j].mEnvVar.empty())
+                {
+                    out->Put("Environment: <code>$");
+                    out->Put(mOptions[j].mEnvVar);
+                    out->Put("</code>");
+                }
+
+                out->Put("</blockquote>");
+            }
+        }
+
+        if (!mEnumSpecs.empty())
+        {
+            out->Put("\n<p><h3>Types</h3></p>");
+            AddEnumDocs(out, "", mEnumSpecs, helpType);
+        }
+
+        out->Put("</td></tr>");     // end frame
+        return;
+    }
+
+    if (helpType == kHelpMarkdown)
+    {
+        out->Put(mCommandDescription);
+    #ifdef AS_MD_USE_DD
+        out->Put("\n\n### Usage\n\n**");
+    #else
+        out->Put("\n\n### Usage\n> **");
+    #endif
+        out->Put(commandName);
+        out->Put("** ");
+
+        if (!mOptions.empty())
+            out->Put("[*options*] ");
+
+        AddArgDocs(out, mMainArgs.mArguments, helpType);
+    #ifdef AS_MD_USE_DD
+        out->Put("\n<dl><dd>    ");
+        out->Put(mMainArgs.mDescription);
+        out->Put("    </dd></dl>\n\n");
+    #else
+        out->Put(">>  ");
+        out->Put(mMainArgs.mDescription);
+        out->Put("\n");
+    #endif
+        if (!mOptions.empty())
+        {
+            out->Put("\n### Options\n\n");
+
+            for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+            {
+            #ifdef AS_MD_USE_DD
+                out->Put("**-");
+            #else
+                out->Put("> **-");
+            #endif
+                out->Put(mOptions[j].mName);
+                out->Put("** ");
+                AddArgDocs(out, mOptions[j].mArguments, helpType);
+            #ifdef AS_MD_USE_DD
+                out->Put("\n<dl><dd>    ");
+                out->Put(mOptions[j].mDescription);
+            #else
+                out->Put(">>  ");
+                out->Put(mOptions[j].mDescription);
+            #endif
+                if (!mOptions[j].mEnvVar.empty())
+                {
+                    out->Put(" Environment: `$");
+                    out->Put(mOptions[j].mEnvVar);
+                    out->Put('`');
+                }
+            #ifdef AS_MD_USE_DD
+                out->Put("    </dd></dl>\n\n");
+            #else
+                out->Put("\n\n");
+            #endif
+            }
+        }
+
+        if (!mEnumSpecs.empty())
+        {
+            out->Put("\n### Types\n");
+        #ifdef AS_MD_USE_DD
+            AddEnumDocs(out, "", mEnumSpecs, helpType);
+        #else
+            AddEnumDocs(out, "> ", mEnumSpecs, helpType);
+        #endif
+        }
+
+        return;
+    }
+
+    out->Put(mCommandDescription);
+    out->Put("\n\nUsage:\n    ");
+    out->Put(commandName);
+    out->Put(' ');
+
+    if (!mOptions.empty())
+        out->Put("[options] ");
+
+    AddArgDocs(out, mMainArgs.mArguments, helpType);
+    if (!mMainArgs.mDescription.empty())
+        AddDocString(out, "        ", mMainArgs.mDescription);
+
+    if (!mOptions.empty())
+    {
+        out->Put("\nOptions:\n");
+
+        for (size_t j = 0, nj = mOptions.size(); j < nj; j++)
+        {
+            out->Put("    -");
+            out->Put(mOptions[j].mName);
+            out->Put(' ');
+            AddArgDocs(out, mOptions[j].mArguments, helpType);
+            AddDocString(out, "        ", mOptions[j].mDescription);
+
+            if (!mOptions[j].mEnvVar.empty())
+            {
+                out->Put("        Environment: $");
+                out->Put(mOptions[j].mEnvVar);
+                out->Put('\n');
+            }
+        }
+    }
+
+    if (!mEnumSpecs.empty())
+    {
+        out->Put("\nTypes:");
+        AddEnumDocs(out, "    ", mEnumSpecs, helpType);
+    }
+}
+
+void cArgSpec::Internal::CreateErrorString(const cArgParseContext& context, tArgString* errorString) const
+{
+#if AS_INSTRUMENT
+    cPhaseTimer timer(mStats, kPhaseReport);
+#endif
+    cAllocScope scope(context.mAllocator);
+
+    const cArgErrorInfo& ei = context.mError;
+
+    // Note: it's only here we need argv to still be valid.
+    const char* arg = (ei.mArgIndex >= 0 && ei.mArgIndex < context.mArgc) ? context.mArgv[ei.mArgIndex] + ei.mOffset : "";
+    int argLength = ei.mLength >= 0 ? ei.mLength : int(strlen(arg));
+
+    errorString->clear();
+
+    switch (ei.mError)
+    {
+    case kArgNoError:
+        return;
+    case kArgHelpRequested:
+        CreateHelpString(context.mArgv[0], errorString, kHelpFull);
+        return;
+    case kArgErrorNotEnoughArgs:
+        if (ei.mOption >= 0)
+            Sprintf(errorString, "Not enough arguments: expecting at least %d more", ei.mExpected);
+        else
+            Sprintf(errorString, "Not enough main arguments: expecting at least %d more", ei.mExpected);
+        break;
+    case kArgErrorTooManyArgs:
+        if (ei.mOption >= 0)
+            Sprintf(errorString, "Too many arguments (expecting at most %d)", ei.mExpected);
+        else
+            Sprintf(errorString, "Too many main arguments (expecting at most %d)\n", ei.mExpected);
+        break;
+    case kArgErrorBadSpec:
+        if (mTypeMismatch)
+            Sprintf(errorString, "Bad spec: a bound variable's type doesn't match its argument");
+        else
+            Sprintf(errorString, "Unknown arg type %d", ei.mType);
+        break;
+    case kArgErrorUnknownOption:
+        Sprintf(errorString, "Unknown option '%.*s'", argLength, arg);
+        break;
+    case kArgErrorAmbiguousOption:
+        {
+            Sprintf(errorString, "Ambiguous option '%.*s', could be", argLength, arg);
+
+            const int kMaxCandidates = 8;
+            int numCandidates = 0;
+
+            for (int i = 0, n = int(mOptions.size()); i < n; i++)
+            {
+                const cOptionsSpec& option = mOptions[i];
+
+                if (option.mName.size() >= size_t(argLength) && Eq(option.mName.c_str(), arg, argLength)
+                    && FindOption(option.mName.data(), option.mName.size()) == i)   // skip repeats
+                {
+                    if (numCandidates++ == kMaxCandidates)
+                    {
+                        errorString->append(" ...");
+                        break;
+                    }
+
+                    SprintfAppend(errorString, " -%s", option.mName.c_str());
+                }
+            }
+        }
+        break;
+    case kArgErrorBadEnum:
+        {
+            int enumIndex = (ei.mType & kTypeBaseMask) - kTypeEnumBegin;
+            const char* enumName = (enumIndex >= 0 && enumIndex < int(mEnumSpecs.size())) ? mEnumSpecs[enumIndex].mName.c_str() : "unknown";
+
+            Sprintf(errorString, "Unknown enum '%.*s' of type %s", argLength, arg, enumName);
+        }
+        break;
+    case kArgErrorGarbage:
+        Sprintf(errorString, "Garbage at end of number: '%.*s' ", argLength, arg);
+        break;
+    case kArgErrorRange:
+        Sprintf(errorString, "Number out of range: '%.*s'", argLength, arg);
+        break;
+    case kArgErrorResponseFile:
+        Sprintf(errorString, "Response file '%.*s' includes itself, is nested too deeply, or expands to too much", argLength, arg);
+        break;
+    case kArgErrorConfigFile:
+        if (ei.mLine > 0)
+            Sprintf(errorString, "Expected 'name = values', not '%.*s'", argLength, arg);
+        else
+            Sprintf(errorString, "Couldn't read config file '%s'", context.mConfigPath.c_str());
+        break;
+    default:
+        Sprintf(errorString, "Unknown error %d", ei.mError);
+    }
+
+    if (ei.mOption >= 0)
+        SprintfAppend(errorString, " in -%s", mOptions[ei.mOption].mName.c_str());
+    if (context.mEnvVar)
+        SprintfAppend(errorString, " (from $%s)", context.mEnvVar);
+
+    if (ei.mLine > 0)
+    {
+        tArgString location;
+        Sprintf(&location, "%s:%d: ", context.mConfigPath.c_str(), ei.mLine);
+        errorString->insert(0, location);
+    }
+}
+
+tArgError cArgSpec::Internal::ParseArgument(cArgParseContext* context, const cArgInfo& info, const char**& argv, const char** argvEnd) const
+{
+    void* location = context->mBindings ? context->mBindings[info.mBinding] : info.mLocation;
+
+    if (info.mFlagToSet >= 0)
+        context->SetFlag(info.mFlagToSet);
+
+#if AS_INSTRUMENT
+    cPhaseTimer timer(mStats, (info.mType & (kTypeArrayListFlag | kTypeArraySplitFlag)) ? kPhaseArrays : kPhaseConvert);
+#endif
+
+    return info.mConvert(context, info, location, argv, argvEnd);
+}
+
+template<class T_ARG> tArgError cArgSpec::Internal::ConvertValue(cArgParseContext*, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd)
+{
+    typedef typename T_ARG::tValue tValue;
+
+    if (!location)
+    {
+        tValue ignored;
+        return T_ARG::Parse(info, &ignored, argv, argvEnd);
+    }
+
+    return T_ARG::Parse(info, static_cast<tValue*>(location), argv, argvEnd);
+}
+
+template<class T_ARG> tArgError cArgSpec::Internal::ConvertList(cArgParseContext*, const cArgInfo& info, void* location, const char**& argv, const char** argvEnd)
+{
+    typedef typename T_ARG::tValue tValue;
+    vector<tValue>* values = static_cast<vector<tValue>*>(location);
+
+    if (values)
+    {
+        values->clear();
+
+        // Count the list up front, so it's allocated once, if at all
+        const char** listEnd = argv;
+
+        while (listEnd < argvEnd && !IsOption(*listEnd))
+            listEnd++;
+
+        values->reserve((listEnd - argv + T_ARG::kArgsPerValue - 1) / T_ARG::kArgsPerValue);
+    }
+
+    tValue value;
+
+    do
+    {
+        if (IsOption(argv[0]))
+            return kArgNoError;
+
+        tArgError error = T_ARG::Parse(info, &value, argv, argvEnd);
+
+        if (error != kArgNoError)
+            return error;
+
+        if (values)
+            values->push_back(value);
+    }
+    while (argv < argvEnd);
+
+    return kArgNoError;
+}
+
+template<class T_ARG> tArgError cArgSpec::Internal::ConvertSplit(cArgParseContext* context, const cArgInfo& info, void* location, const char**& argv, const char**)
+{
+    typedef typename T_ARG::tValue tValue;
+    vector<tValue>* values = static_cast<vector<tValue>*>(location);
+
+    if (values)
+        values->clear();
+
+    const char* arg = *argv++;
+    size_t length = strlen(arg);
+    const char* source = arg;
+
+    if (T_ARG::kSplitCopy)
+    {
+        context->mScratch.emplace_back(arg, arg + length + 1);
+        source = context->mScratch.back().data();
+    }
+
+    cSplitScanner scanner(source, source + length, *info.mSeparators);
+    const char* token = source;
+    const char* tokenEnd = source;
+
+    tArgError error = T_ARG::ParseSplit(info, values, &scanner, &token, &tokenEnd);
+
+    if (error != kArgNoError)
+    {
+        context->mError.mOffset = int(token - source);
+        context->mError.mLength = int(tokenEnd - token);
+    }
+
+    return error;
+}
+
+tArgError cArgSpec::Internal::ConvertInvalid(cArgParseContext*, const cArgInfo&, void*, const char**& argv, const char**)
+{
+    argv++;
+    return kArgErrorBadSpec;
+}
+
+template<class T_ARG> tArgConverter cArgSpec::Internal::Converter(tArgType type)
+{
+    if (type & kTypeArrayListFlag)
+        return ConvertList<T_ARG>;
+    if (type & kTypeArraySplitFlag)
+        return ConvertSplit<T_ARG>;
+
+    return ConvertValue<T_ARG>;
+}
+
+void cArgSpec::Internal::ResolveConverters()
+{
+    ResolveConverters(&mMainArgs.mArguments);
+
+    for (cOptionsSpec& option : mOptions)
+        ResolveConverters(&option.mArguments);
+}
+
+void cArgSpec::Internal::ResolveConverters(tArgVector<cArgInfo>* args)
+// Pick the converter for each argument up front, so Parse() needn't switch on type.
+{
+    for (cArgInfo& info : *args)
+    {
+        uint32_t baseType = info.mType & kTypeBaseMask;
+
+        info.mSeparators = &mSeparators;
+        info.mEnumSpec = nullptr;
+
+        switch (baseType)
+        {
+        case kTypeBool:
+            info.mConvert = Converter<cValueArg<bool>>(info.mType);
+            break;
+        case kTypeInt:
+            info.mConvert = Converter<cValueArg<int>>(info.mType);
+            break;
+        case kTypeFloat:
+            info.mConvert = Converter<cValueArg<float>>(info.mType);
+            break;
+        case kTypeDouble:
+            info.mConvert = Converter<cValueArg<double>>(info.mType);
+            break;
+        case kTypeCString:
+            info.mConvert = Converter<cCStringArg>(info.mType);
+            break;
+        case kTypeString:
+            info.mConvert = Converter<cValueArg<string>>(info.mType);
+            break;
+        case kTypeVec2:
+            info.mConvert = Converter<cVecArg<Vec2>>(info.mType);
+            break;
+        case kTypeVec3:
+            info.mConvert = Converter<cVecArg<Vec3>>(info.mType);
+            break;
+        case kTypeVec4:
+            info.mConvert = Converter<cVecArg<Vec4>>(info.mType);
+            break;
+
+        default:
+            if (baseType >= kTypeEnumBegin && size_t(baseType - kTypeEnumBegin) < mEnumSpecs.size())
+            {
+                info.mEnumSpec = &mEnumSpecs[baseType - kTypeEnumBegin];
+                info.mConvert = Converter<cEnumArg>(info.mType);
+            }
+            else
+                info.mConvert = ConvertInvalid;
+        }
+    }
+}
+
+tArgError cArgSpec::Internal::ParseOptionArgs(cArgParseContext* context, const tArgVector<cArgInfo>& optArgs, const char**& argv, const char** argvEnd) const
+{
+    size_t i = 0;
+    size_t n = optArgs.size();
+
+    while (argv < argvEnd && i < n && !IsOption(*argv))
+    {
+        tArgError error = ParseArgument(context, optArgs[i], argv, argvEnd);
+
+        if (error != kArgNoError)
+        {
+            context->mError.mType = optArgs[i].mType;
+            return SetError(context, error, argv - 1);
+        }
+
+        i++;
+    }
+
+    if (i < n && optArgs[i].mIsRequired)
+    {
+        size_t numHave = i;
+
+        do
+            i++;
+        while (i < n && optArgs[i].mIsRequired);
+
+        return SetError(context, kArgErrorNotEnoughArgs, argv, int(i - numHave));
+    }
+
+    return kArgNoError;
+}
+
+tArgError cArgSpec::Internal::ParseOption(cArgParseContext* context, const char**& argv, const char** argvEnd) const
+{
+    const char* optionName = argv[0] + 1;
+
+    argv++;
+
+    if (optionName[0] == kOptionChar)   // handle '--option', and skip '--', used as an open-ended list terminator
+    {
+        optionName++;
+        if (optionName[0] == 0)
+            return kArgNoError;
+    }
+
+    if (Eq(optionName, "h"))
+        context->mHelpRequested = true;
+
+    int optionIndex = LookupOption(optionName, strlen(optionName), context->mHelpRequested);
+
+    if (optionIndex == cPrefixTrie::kAmbiguous)
+    {
+        context->mError.mOffset = int(optionName - argv[-1]);
+        return SetError(context, kArgErrorAmbiguousOption, argv - 1);
+    }
+
+    if (optionIndex >= 0)
+    {
+        const cOptionsSpec& option = mOptions[optionIndex];
+
+        if (option.mFlagToSet >= 0)
+            context->SetFlag(option.mFlagToSet);
+
+        if (!context->mEnvErrors.empty())   // we override any bad value in the environment
+        {
+            tArgVector<int>& errors = context->mEnvErrors;
+            errors.erase(std::remove(errors.begin(), errors.end(), optionIndex), errors.end());
+        }
+
+        tArgError err = ParseOptionArgs(context, option.mArguments, argv, argvEnd);
+
+        if (err != kArgNoError)
+            context->mError.mOption = optionIndex;
+
+        return err;
+    }
+
+    if (context->mHelpRequested)
+        return SetError(context, kArgHelpRequested, argv - 1);
+
+    context->mError.mOffset = int(optionName - argv[-1]);
+    return SetError(context, kArgErrorUnknownOption, argv - 1);
+}
+
+tArgError cArgSpec::Internal::ParseEnvironment(cArgParseContext* context) const
+// Applies options bound to environment variables, in one pass over environ,
+// rather than a getenv() per option. Values that don't parse are noted in
+// mEnvErrors rather than failing, as the command line may override them.
+{
+    char** env = AS_ENVIRON;
+    int argc = context->mArgc;
+    const char** argv = context->mArgv;
+
+    if (mEnvTable.mCount == 0 || !env)
+        return kArgNoError;
+
+    cEnvIndex index(env);
+
+    for ( ; *env; env++)
+    {
+        const char* entry = *env;
+        const char* eq = strchr(entry, '=');
+
+        if (!eq || eq == entry)     // Windows keeps per-drive directories as "=C:=..."
+            continue;
+
+        size_t nameLength = eq - entry;
+        int optionIndex = mEnvTable.Find(FoldedHash(entry, nameLength),
+            [&](int i)
+            {
+                const tArgString& name = mOptions[i].mEnvVar;
+                return name.size() == nameLength && EnvNameEq(name.data(), entry, nameLength);
+            }
+        );
+
+        if (optionIndex >= 0 && eq[1] != 0)    // treat empty as unset
+        {
+            if (ParseEnvOption(context, optionIndex, eq + 1, &index) != kArgNoError)
+            {
+                context->mEnvErrors.push_back(optionIndex);
+                context->mError = cArgErrorInfo();
+                context->mEnvVar = nullptr;
+                context->mArgc = argc;
+                context->mArgv = argv;
+            }
+        }
+    }
+
+    return kArgNoError;
+}
+
+tArgError cArgSpec::Internal::EnvironmentError(cArgParseContext* context) const
+// Reports the first environment value that didn't parse, and wasn't overridden
+// by the command line, by parsing it again, as errors are rare.
+{
+    char** env = AS_ENVIRON;
+    cEnvIndex index(env);
+
+    for (int optionIndex : context->mEnvErrors)
+    {
+        const tArgString& name = mOptions[optionIndex].mEnvVar;
+        const char* value = env ? index.Find(name.data(), name.size()) : nullptr;
+
+        if (value && value[0])
+        {
+            tArgError error = ParseEnvOption(context, optionIndex, value, &index);
+
+            if (error != kArgNoError)
+                return error;
+        }
+    }
+
+    return kArgNoError;
+}
+
+tArgError cArgSpec::Internal::ParseEnvOption(cArgParseContext* context, int optionIndex, const char* value, cEnvIndex* index) const
+{
+    const cOptionsSpec& option = mOptions[optionIndex];
+    tArgVector<const char*>& tokens = context->mValueTokens;
+
+    tokens.assign(1, option.mEnvVar.c_str());     // stands in for argv[0]
+
+    bool split = SplitsValue(option);
+
+    if (split || strstr(value, "${"))
+    {
+        context->mScratch.emplace_back();
+        tArgVector<char>& copy = context->mScratch.back();
+
+        ExpandEnvRefs(value, index, &copy);
+
+        if (split)
+            TokenizeInPlace(copy.data(), copy.data() + copy.size() - 1, &tokens);
+        else
+            tokens.push_back(copy.data());
+    }
+    else
+        tokens.push_back(value);
+
+    tArgError error = ParseOptionTokens(context, optionIndex);
+
+    if (error != kArgNoError)
+        context->mEnvVar = option.mEnvVar.c_str();
+
+    return error;
+}
+
+bool cArgSpec::Internal::SplitsValue(const cOptionsSpec& option)
+// Values from the environment or a config file are only split into tokens
+// if the option takes more than one, so "-name %s" can be given "a b".
+{
+    const tArgVector<cArgInfo>& args = option.mArguments;
+    return args.size() > 1 || (args.size() == 1 && (args[0].mType & kTypeArrayListFlag));
+}
+
+tArgError cArgSpec::Internal::ParseOptionTokens(cArgParseContext* context, int optionIndex) const
+// Parses context->mValueTokens[1..] as if they followed the given option on
+// the command line. On error, mArgv is left pointing at them for ErrorString().
+{
+    const cOptionsSpec& option = mOptions[optionIndex];
+    const tArgVector<cArgInfo>& args = option.mArguments;
+    tArgVector<const char*>& tokens = context->mValueTokens;
+
+    if (args.empty())
+    {
+        bool enabled = true;
+
+        if (tokens.size() == 2)
+        {
+            const char* s = tokens[1];
+
+            if (ScanBool(s, s + strlen(s), &enabled) != kArgNoError || *s != 0)
+                enabled = true;     // any other value just means it's set
+        }
+
+        if (enabled && option.mFlagToSet >= 0)
+            context->SetFlag(option.mFlagToSet);
+
+        return kArgNoError;
+    }
+
+    if (option.mFlagToSet >= 0)
+        context->SetFlag(option.mFlagToSet);
+
+    int argc = context->mArgc;
+    const char** argvSaved = context->mArgv;
+
+    context->mArgc = int(tokens.size());
+    context->mArgv = tokens.data();
+
+    const char** argv = tokens.data() + 1;
+    const char** argvEnd = tokens.data() + tokens.size();
+
+    tArgError error = ParseOptionArgs(context, args, argv, argvEnd);
+
+    if (error == kArgNoError && argv < argvEnd)
+        error = SetError(context, kArgErrorTooManyArgs, argv, int(args.size()));
+
+    if (error != kArgNoError)
+    {
+        context->mError.mOption = optionIndex;
+        return error;
+    }
+
+    context->mArgc = argc;
+    context->mArgv = argvSaved;
+
+    return kArgNoError;
+}
+
+tArgError cArgSpec::Internal::ParseConfig(cArgParseContext* context) const
+// Applies "name = values" lines from context->mConfigPath. The file is
+// mapped copy-on-write and tokenized in place, like a response file, and
+// kept until the next Parse(), so string values can point into it.
+{
+    cMappedFile* file = NewArg<cMappedFile>(context->mAllocator);
+
+    if (!file->Open(context->mConfigPath.c_str(), true))
+    {
+        DeleteArg(context->mAllocator, file);
+        context->mError.mError = kArgErrorConfigFile;
+        return kArgErrorConfigFile;
+    }
+
+    context->mFiles.push_back(file);
+
+    tArgVector<const char*>& tokens = context->mValueTokens;
+    char* s = file->mData;
+    char* end = file->mData + file->mSize;
+
+    for (int line = 1; s < end; line++)
+    {
+        char* lineEnd = static_cast<char*>(memchr(s, '\n', end - s));
+
+        if (!lineEnd)
+            lineEnd = end;  // there's always a writable byte after the mapping
+
+        char* next = lineEnd + 1;
+
+        while (s < lineEnd && isspace((unsigned char) *s))
+            s++;
+        while (lineEnd > s && isspace((unsigned char) lineEnd[-1]))
+            lineEnd--;
+
+        if (s == lineEnd || *s == '#' || *s == ';' || *s == '[')
+        {
+            s = next;
+            continue;
+        }
+
+        char* eq = static_cast<char*>(memchr(s, '=', lineEnd - s));
+        char* nameEnd = eq ? eq : lineEnd;
+
+        while (nameEnd > s && isspace((unsigned char) nameEnd[-1]))
+            nameEnd--;
+
+        tokens.clear();
+        tokens.push_back(context->mConfigPath.c_str());    // stands in for argv[0]
+
+        int optionIndex = eq ? FindOption(s, nameEnd - s) : -1;
+
+        if (optionIndex < 0)
+        {
+            tArgError error = eq ? kArgErrorUnknownOption : kArgErrorConfigFile;
+
+            *nameEnd = 0;   // for ErrorString()
+            tokens.push_back(s);
+            context->mArgc = int(tokens.size());
+            context->mArgv = tokens.data();
+            context->mError.mLine = line;
+            return SetError(context, error, tokens.data() + 1);
+        }
+
+        char* value = eq + 1;
+
+        if (SplitsValue(mOptions[optionIndex]))
+            TokenizeInPlace(value, lineEnd, &tokens);
+        else
+        {
+            while (value < lineEnd && isspace((unsigned char) *value))
+                value++;
+
+            *lineEnd = 0;
+
+            if (value < lineEnd)
+                tokens.push_back(value);
+        }
+
+        tArgError error = ParseOptionTokens(context, optionIndex);
+
+        if (error != kArgNoError)
+        {
+            context->mError.mLine = line;
+            return error;
+        }
+
+        s = next;
+    }
+
+    return kArgNoError;
+}
+
+int cArgSpec::Internal::LookupOption(const char* name, size_t nameLength, bool exactOnly) const
+// Returns the option matching 'name' exactly, or failing that as an abbreviation, or kNotFound/kAmbiguous.
+{
+#if AS_INSTRUMENT
+    cPhaseTimer timer(mStats, kPhaseLookup);
+#endif
+
+    int optionIndex = FindOption(name, nameLength);
+
+    if (optionIndex < 0 && !exactOnly)
+        optionIndex = mOptionTrie.Find(name, nameLength);
+
+#if AS_INSTRUMENT
+    if (optionIndex >= 0 && mStats.Enabled())
+        cStats::Add(mStats.mOptionHits[optionIndex], 1);
+#endif
+
+    return optionIndex;
+}
+
+tArgError cArgSpec::Internal::SetError(cArgParseContext* context, tArgError error, const char** argv, int expected)
+{
+    context->mError.mError    = error;
+    context->mError.mArgIndex = int(argv - context->mArgv);
+    context->mError.mExpected = expected;
+    return error;
+}
+
+tArgError cArgSpec::Internal::ExpandArg(cArgParseContext* context, const char* arg, const cFileChain* chain)
+{
+    if (!IsResponseFile(arg))
+    {
+        context->mArgs.push_back(arg);
+        return kArgNoError;
+    }
+
+    cMappedFile* file = NewArg<cMappedFile>(context->mAllocator);
+
+    if (!file->Open(arg + 1, true))
+    {
+        // As with gcc, treat as a literal argument if it can't be read
+        DeleteArg(context->mAllocator, file);
+        context->mArgs.push_back(arg);
+        return kArgNoError;
+    }
+
+    // A file may include another several times over, so without a cap, expansion can grow exponentially
+    bool reject = context->mFiles.size() >= kMaxResponseFiles || context->mArgs.size() >= kMaxResponseFileArgs;
+
+    for (const cFileChain* link = chain; link && !reject; link = link->mParent)
+    {
+        bool sameFile = (file->mID[0] | file->mID[1]) != 0 && memcmp(file->mID, link->mFile->mID, sizeof(file->mID)) == 0;
+
+        reject = sameFile || link->mDepth >= kMaxResponseFileDepth;
+    }
+
+    if (reject)
+    {
+        DeleteArg(context->mAllocator, file);
+        context->mArgs.push_back(arg);
+        return kArgErrorResponseFile;
+    }
+
+    context->mFiles.push_back(file);
+
+    // Tokens are appended to mFileTokens while we process them, then dropped
+    tArgVector<const char*>& tokens = context->mFileTokens;
+    size_t begin = tokens.size();
+
+    TokenizeInPlace(file->mData, file->mData + file->mSize, &tokens);
+
+    size_t end = tokens.size();
+    cFileChain link = { file, chain, chain ? chain->mDepth + 1 : 1 };
+
+    for (size_t i = begin; i < end; i++)
+    {
+        tArgError error = ExpandArg(context, tokens[i], &link);
+
+        if (error != kArgNoError)
+            return error;
+    }
+
+    tokens.resize(begin);
+    return kArgNoError;
+}
+
+void cArgSpec::Internal::AddOption(cOptionsSpec&& option)
+{
+    // Earlier options win if a name is repeated, as with the original linear search.
+    if (FindOption(option.mName.data(), option.mName.size()) < 0)
+    {
+        mOptionTable.Insert(option.mNameHash, int(mOptions.size()));
+        mOptionTrie.Insert(option.mName.data(), option.mName.size(), int(mOptions.size()));
+    }
+
+    if (!option.mEnvVar.empty())
+    {
+        const char* name = option.mEnvVar.data();
+        size_t nameLength = option.mEnvVar.size();
+        uint32_t hash = FoldedHash(name, nameLength);
+
+        auto sameName = [&](int i) { return mOptions[i].mEnvVar.size() == nameLength && EnvNameEq(mOptions[i].mEnvVar.data(), name, nameLength); };
+
+        if (mEnvTable.Find(hash, sameName) < 0)
+            mEnvTable.Insert(hash, int(mOptions.size()));
+    }
+
+    mOptions.push_back(std::move(option));
+
+#if AS_INSTRUMENT
+    mStats.Reserve(mOptions.size());
+#endif
+}
+
+int cArgSpec::Internal::FindOption(const char* name, size_t nameLength) const
+{
+    return mOptionTable.Find(FoldedHash(name, nameLength),
+        [&](int i)
+        {
+            const tArgString& optionName = mOptions[i].mName;
+            return optionName.size() == nameLength && Eq(optionName.data(), name, nameLength);
+        }
+    );
+}
+
+cEnumSpec& cArgSpec::Internal::AddEnum(const char* name, const cArgEnumInfo* enumInfo)
+// Callers must fill in the tokens and call Index() on the result.
+{
+    size_t nameLength = strlen(name);
+
+    if (FindEnum(name, nameLength) < 0)
+        mEnumTable.Insert(FoldedHash(name, nameLength), int(mEnumSpecs.size()));
+
+    mEnumSpecs.push_back(cEnumSpec(name, enumInfo));
+    return mEnumSpecs.back();
+}
+
+int cArgSpec::Internal::FindEnum(const char* name, size_t nameLength) const
+{
+    return mEnumTable.Find(FoldedHash(name, nameLength),
+        [&](int i)
+        {
+            const tArgString& enumName = mEnumSpecs[i].mName;
+            return enumName.size() == nameLength && Eq(enumName.data(), name, nameLength);
+        }
+    );
+}
+
+void cArgSpec::Internal::AddArgDocs(cHelpOutput* out, const tArgVector<cArgInfo>& args, tHelpType helpType) const
+{
+    int numClauses = 0;
+
+    if (helpType == kHelpHTML)
+        out->Put("<i>");
+
+    for (size_t i = 0, n = args.size(); i < n; i++)
+    {
+        const cArgInfo& ai = args[i];
+
+        if (i != 0)
+            out->Put(" ");
+
+        if (!ai.mIsRequired)
+        {
+            out->Put(kOpenBracketChar);
+            numClauses++;
+        }
+
+        if (helpType == kHelpHTML)
+            out->Put("&lt;");
+        else if (helpType != kHelpMarkdown)
+            out->Put("<");
+
+        if (!ai.mName.empty())
+        {
+            out->Put(ai.mName);
+            out->Put(':');
+        }
+
+        if (helpType == kHelpMarkdown)
+            out->Put("_");
+
+        out->Put(NameFromArgType(ai.mType));
+
+        if (ai.mType & kTypeArraySplitFlag)
+            out->Put("[]");
+
+        if (helpType == kHelpHTML)
+            out->Put("&gt;");
+        else if (helpType == kHelpMarkdown)
+            out->Put("_");
+        else
+            out->Put(">");
+
+        if (ai.mType & kTypeArrayListFlag)
+        {
+            out->Put(" ");
+            out->Put(kEllipsisToken);
+        }
+    }
+
+    for (int i = 0; i < numClauses; i++)
+        out->Put(kCloseBracketChar);
+
+    if (helpType == kHelpHTML)
+        out->Put("</i>");
+
+    out->Put("\n");
+}
+
+void cArgSpec::Internal::FindNameAndTypeFromOption(const char* str, size_t length, tArgType* type, tArgString* name) const
+{
+    name->clear();
+
+    if (length == 0)
+    {
+        *type = kTypeInvalid;
+        return;
+    }
+    if (length > 1 && str[0] == kFormatChar)
+    {
+        switch (str[1])
+        {
+        case 'f':
+        case 'g':
+            *type = kTypeFloat;
+            break;
+        case 'F':
+        case 'G':
+            *type = kTypeDouble;
+            break;
+        case 'd':
+            *type = kTypeInt;
+            break;
+        case 'b':
+            *type = kTypeBool;
+            break;
+        case 's':
+            *type = kTypeCString;
+            break;
+        default:
+            *type = kTypeInvalid;
+        }
+    }
+    else
+    {
+        const char* typeStr = str;
+        const char* typeEnd = str + length;
+
+        if (typeStr[0] == kBeginArgChar && typeEnd[-1] == kEndArgChar)
+        {
+            typeStr++;
+            typeEnd--;
+        }
+
+        const char* sep = static_cast<const char*>(memchr(typeStr, kArgSepChar, size_t(typeEnd - typeStr)));
+
+        if (sep)
+        {
+            name->assign(typeStr, sep);
+            typeStr = sep + 1;
+        }
+
+        (*type) = ArgTypeFromName(typeStr, size_t(typeEnd - typeStr));
+    }
+}
+
+const char* cArgSpec::Internal::NameFromArgType(tArgType argType) const
+{
+    uint32_t baseArgType = argType & kTypeBaseMask;
+
+    switch (baseArgType)
+    {
+    case kTypeBool:
+        return "bool";
+    case kTypeInt:
+        return "int";
+    case kTypeFloat:
+        return "float";
+    case kTypeDouble:
+        return "double";
+    case kTypeCString:
+    case kTypeString:
+        return "string";
+
+    case kTypeVec2:
+        return "vec2";
+    case kTypeVec3:
+        return "vec3";
+    case kTypeVec4:
+        return "vec4";
+
+    case kTypeInvalid:
+        return "invalid";
+
+    default:
+        if (baseArgType >= kTypeEnumBegin && size_t(baseArgType - kTypeEnumBegin) < mEnumSpecs.size())
+            return mEnumSpecs[baseArgType - kTypeEnumBegin].mName.c_str();
+    }
+
+    return "unknown";
+}
+
+tArgType cArgSpec::Internal::ArgTypeFromName(const char* typeName, size_t typeLen) const
+// typeName need not be NUL-terminated, e.g., it may point into a spec string.
+{
+    tArgType arrayFlag = tArgType(0);
+
+    if (typeLen > 2 && typeName[typeLen - 2] == '[' && typeName[typeLen - 1] == ']')
+    {
+        arrayFlag = kTypeArraySplitFlag;
+        typeLen -= 2;
+    }
+
+    if (Eq(typeName, "bool", typeLen))
+        return kTypeBool | arrayFlag;
+    if (Eq(typeName, "int", typeLen))
+        return kTypeInt | arrayFlag;
+    if (Eq(typeName, "float", typeLen))
+        return kTypeFloat | arrayFlag;
+    if (Eq(typeName, "double", typeLen))
+        return kTypeDouble | arrayFlag;
+    if (Eq(typeName, "string", typeLen))
+        return kTypeString | arrayFlag;
+    if (Eq(typeName, "cstr", typeLen) || Eq(typeName, "cstring", typeLen))
+        return kTypeCString | arrayFlag;
+
+    if (typeLen > 0 && typeName[0] == 'v')
+    {
+        if (Eq(typeName, "v2", typeLen) || Eq(typeName, "vec2", typeLen) || Eq(typeName, "vector2", typeLen))
+            return kTypeVec2 | arrayFlag;
+        if (Eq(typeName, "v3", typeLen) || Eq(typeName, "vec3", typeLen) || Eq(typeName, "vector3", typeLen))
+            return kTypeVec3 | arrayFlag;
+        if (Eq(typeName, "v4", typeLen) || Eq(typeName, "vec4", typeLen) || Eq(typeName, "vector4", typeLen))
+            return kTypeVec4 | arrayFlag;
+    }
+
+    int enumIndex = FindEnum(typeName, typeLen);
+
+    if (enumIndex >= 0)
+        return tArgType(kTypeEnumBegin + enumIndex) | arrayFlag;
+
+    AS_ASSERT_F(0, "bad argument spec type\n");
+    return kTypeInvalid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Completion
+//
+
+const cArgSpec::Internal::cCompletionIndex& cArgSpec::Internal::CompletionIndex() const
+// Built once, then kept until the spec changes, like rendered help.
+{
+    std::lock_guard<std::mutex> lock(mHelpMutex);
+
+    if (mCompletionIndex)
+        return *mCompletionIndex;
+
+    cAllocScope scope(mAllocator);
+    mCompletionIndex = std::unique_ptr<cCompletionIndex, cArgDeleter>(NewArg<cCompletionIndex>(mAllocator), cArgDeleter { mAllocator });
+
+    cCompletionIndex& index = *mCompletionIndex;
+
+    for (int i = 0, n = int(mOptions.size()); i < n; i++)
+        if (FindOption(mOptions[i].mName.data(), mOptions[i].mName.size()) == i)    // skip repeats
+            index.mOptions.Add(mOptions[i].mName.data(), mOptions[i].mName.size(), i);
+
+    index.mOptions.Sort();
+    index.mEnums.resize(mEnumSpecs.size());
+
+    for (size_t i = 0; i < mEnumSpecs.size(); i++)
+    {
+        const cEnumSpec& enumSpec = mEnumSpecs[i];
+
+        for (size_t j = 0; j < enumSpec.mNumTokens; j++)
+        {
+            size_t length;
+            const char* token = enumSpec.Token(j, &length);
+            index.mEnums[i].Add(token, length, int(j));
+        }
+
+        index.mEnums[i].Sort();
+    }
+
+    return index;
+}
+
+int cArgSpec::Internal::Complete(int argc, const char** argv, int index, vector<string>* completions, string* hint) const
+{
+    completions->clear();
+
+    if (hint)
+        hint->clear();
+
+    // Find the argument expected at 'index' by following Parse()'s consumption of
+    // argv, without converting anything.
+    const tArgVector<cArgInfo>* optionArgs = nullptr;
+    size_t optionArg = 0;
+    size_t mainArg = 0;
+    bool inMainList = false;
+
+    for (int j = 1; j < index && j < argc; j++)
+    {
+        const char* arg = argv[j];
+
+        if (IsOption(arg))
+        {
+            const char* name = arg[1] == kOptionChar ? arg + 2 : arg + 1;
+            size_t nameLength = strlen(name);
+            int optionIndex = FindOption(name, nameLength);
+
+            if (optionIndex < 0)
+                optionIndex = mOptionTrie.Find(name, nameLength);
+
+            optionArgs = optionIndex >= 0 ? &mOptions[optionIndex].mArguments : nullptr;
+            optionArg = 0;
+
+            if (inMainList)
+                mainArg++;
+
+            inMainList = false;
+        }
+        else if (optionArgs && optionArg < optionArgs->size())
+        {
+            if (!((*optionArgs)[optionArg].mType & kTypeArrayListFlag))
+                optionArg++;
+        }
+        else if (mainArg < mMainArgs.mArguments.size())
+        {
+            optionArgs = nullptr;
+
+            if (mMainArgs.mArguments[mainArg].mType & kTypeArrayListFlag)
+                inMainList = true;
+            else
+                mainArg++;
+        }
+    }
+
+    const cArgInfo* expected = nullptr;
+
+    if (optionArgs && optionArg < optionArgs->size())
+        expected = &(*optionArgs)[optionArg];
+    else if (mainArg < mMainArgs.mArguments.size())
+        expected = &mMainArgs.mArguments[mainArg];
+
+    const char* word = (index >= 0 && index < argc) ? argv[index] : "";
+    bool isOption = word[0] == kOptionChar && !(isdigit((unsigned char) word[1]) || word[1] == '.');   // not "-1"
+    const cCompletionIndex& completionIndex = CompletionIndex();
+
+    if (isOption || (word[0] == 0 && (!expected || !expected->mIsRequired)))
+    {
+        const char* prefix = word[0] && word[1] == kOptionChar ? word + 2 : word[0] ? word + 1 : word;
+        size_t numDashes = std::max<size_t>(prefix - word, 1);
+
+        completionIndex.mOptions.FindPrefix(prefix, strlen(prefix),
+            [&](const cSortedNames::cEntry& entry)
+            {
+                completions->emplace_back(numDashes, kOptionChar);
+                completions->back().append(entry.mName, entry.mLength);
+            }
+        );
+
+        if (isOption)
+            return int(completions->size());
+    }
+
+    if (!expected)
+        return int(completions->size());
+
+    uint32_t baseType = expected->mType & kTypeBaseMask;
+
+    if (baseType >= kTypeEnumBegin && size_t(baseType - kTypeEnumBegin) < completionIndex.mEnums.size())
+    {
+        completionIndex.mEnums[baseType - kTypeEnumBegin].FindPrefix(word, strlen(word),
+            [&](const cSortedNames::cEntry& entry) { completions->emplace_back(entry.mName, entry.mLength); }
+        );
+    }
+
+    if (hint)
+    {
+        hint->assign(1, kBeginArgChar);
+
+        if (!expected->mName.empty())
+        {
+            hint->append(expected->mName.data(), expected->mName.size());
+            hint->push_back(kArgSepChar);
+        }
+
+        hint->append(NameFromArgType(expected->mType));
+
+        if (expected->mType & kTypeArraySplitFlag)
+            hint->append("[]");
+
+        hint->push_back(kEndArgChar);
+    }
+
+    return int(completions->size());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgSubcommands
+//
+
+namespace
+{
+    const char* Basename(const char* path)
+    {
+        const char* base = path;
+
+        for (const char* s = path; *s; s++)
+        #ifdef _WIN32
+            if (*s == '/' || *s == '\\')
+        #else
+            if (*s == '/')
+        #endif
+                base = s + 1;
+
+        return base;
+    }
+}
+
+struct cArgSubcommands::Internal
+{
+    struct cCommand
+    {
+        const char* mName;
+        const char* mDescription;
+        tFactory*   mFactory;
+        void*       mUserData;
+        std::unique_ptr<cArgSpec, cArgDeleter> mSpec;  // constructed on first use
+        tArgSpecError mSpecError;       // as returned by mFactory, which leaves mSpec unusable if not kSpecNoError
+    };
+
+    Internal(cArgAllocator* allocator, const char* description) :
+        mAllocator(allocator),
+        mDescription(description ? description : "")
+    {}
+
+    cArgAllocator*          mAllocator;
+    const char*             mDescription;
+    tArgVector<cCommand>    mCommands;
+    cNameTable              mCommandTable;  // mCommands by name
+
+    // Results of the last Parse()
+    int                     mSelected = -1;
+    tArgError               mError = kArgNoError;
+    tArgString              mToolName;          // basename of argv[0]
+    const char*             mArg = nullptr;     // offending argument, if we rejected it ourselves
+    tArgString              mCommandName;       // e.g., "tool commit", passed to the subcommand as argv[0]
+    tArgVector<const char*> mArgs;              // the subcommand's argv
+    tArgString              mErrorString;
+
+    int  Find(const char* name, size_t nameLength) const;
+    void WriteHelp(const char* commandName, cHelpOutput* out, tHelpType helpType) const;
+};
+
+int cArgSubcommands::Internal::Find(const char* name, size_t nameLength) const
+{
+    return mCommandTable.Find(FoldedHash(name, nameLength),
+        [&](int i)
+        {
+            const char* commandName = mCommands[i].mName;
+            return Eq(commandName, name, nameLength) && commandName[nameLength] == 0;
+        }
+    );
+}
+
+void cArgSubcommands::Internal::WriteHelp(const char* commandName, cHelpOutput* out, tHelpType helpType) const
+// Top-level help, which only needs the brief descriptions given to Add()
+{
+    if (helpType == kHelpBrief)
+    {
+        out->Put(commandName);
+        out->Put(", ");
+        out->Put(mDescription);
+        return;
+    }
+
+    if (helpType == kHelpHTML)
+    {
+        out->Put("<tr><td><a name=\"");    // start frame
+        out->Put(commandName);
+        out->Put("\"></a>");
+        out->Put("<p>");
+        out->Put(mDescription);
+        out->Put("</p>\n\n");
+        out->Put("<p><h3>Usage</h3></p>\n");
+        out->Put("<b>");
+        out->Put(commandName);
+        out->Put("</b> <i>&lt;command&gt; [&lt;args&gt;]</i>\n");
+        out->Put("<p><h3>Commands</h3></p>\n");
+
+        for (const cCommand& command : mCommands)
+        {
+            out->Put("<b>");
+            out->Put(command.mName);
+            out->Put("</b><br><blockquote>");
+            AddDocString(out, "", tArgString(command.mDescription));
+            out->Put("</blockquote>");
+        }
+
+        out->Put("</td></tr>");     // end frame
+        return;
+    }
+
+    if (helpType == kHelpMarkdown)
+    {
+        out->Put(mDescription);
+        out->Put("\n\n### Usage\n> **");
+        out->Put(commandName);
+        out->Put("** _&lt;command&gt; [&lt;args&gt;]_\n");
+        out->Put("\n### Commands\n\n");
+
+        for (const cCommand& command : mCommands)
+        {
+            out->Put("> **");
+            out->Put(command.mName);
+            out->Put("**\n>>  ");
+            out->Put(command.mDescription);
+            out->Put("\n\n");
+        }
+
+        return;
+    }
+
+    out->Put(mDescription);
+    out->Put("\n\nUsage:\n    ");
+    out->Put(commandName);
+    out->Put(" <command> [<args>]\n");
+
+    if (!mCommands.empty())
+    {
+        out->Put("\nCommands:\n");
+
+        for (const cCommand& command : mCommands)
+        {
+            out->Put("    ");
+            out->Put(command.mName);
+            out->Put('\n');
+            AddDocString(out, "        ", tArgString(command.mDescription));
+        }
+    }
+}
+
+cArgSubcommands::cArgSubcommands(const char* briefDescription, cArgAllocator* allocator) :
+    _(*NewInternal<Internal>(allocator, briefDescription))
+{
+}
+
+cArgSubcommands::~cArgSubcommands()
+{
+    DeleteArg(_.mAllocator, &_);
+}
+
+int cArgSubcommands::Add(const char* name, const char* briefDescription, tFactory* factory, void* userData)
+{
+    cAllocScope scope(_.mAllocator);
+
+    int index = int(_.mCommands.size());
+    size_t nameLength = strlen(name);
+
+    // Earlier commands win if a name is repeated, as for options.
+    if (_.Find(name, nameLength) < 0)
+        _.mCommandTable.Insert(FoldedHash(name, nameLength), index);
+
+    _.mCommands.push_back( { name, briefDescription ? briefDescription : "", factory, userData, { nullptr, cArgDeleter { _.mAllocator } }, kSpecNoError } );
+    return index;
+}
+
+tArgError cArgSubcommands::Parse(int argc, const char** argv)
+{
+    cAllocScope scope(_.mAllocator);
+
+    _.mSelected = -1;
+    _.mArg = nullptr;
+    _.mToolName = argc > 0 ? Basename(argv[0]) : "";  // copied, as argv needn't outlive us
+
+    // A multi-call binary is run via a link named for the subcommand, which then sees all of argv
+    int commandArg = 0;
+    int index = _.Find(_.mToolName.c_str(), _.mToolName.size());
+
+    if (index < 0)
+    {
+        commandArg = 1;
+
+        if (argc < 2 || Eq(argv[1], "-h") || Eq(argv[1], "--h") || Eq(argv[1], "--help"))
+            return _.mError = kArgHelpRequested;
+
+        _.mArg = argv[1];
+
+        if (IsOption(argv[1]))
+            return _.mError = kArgErrorUnknownOption;
+
+        index = _.Find(argv[1], strlen(argv[1]));
+
+        if (index < 0)
+            return _.mError = kArgErrorUnknownCommand;
+    }
+
+    _.mSelected = index;
+    cArgSpec* spec = Spec(index);
+
+    // The subcommand's argv[0] names it in full, for its help and errors
+    _.mCommandName = _.mToolName;
+
+    if (commandArg > 0)
+    {
+        _.mCommandName += ' ';
+        _.mCommandName += _.mCommands[index].mName;
+    }
+
+    if (_.mCommands[index].mSpecError != kSpecNoError)
+        return _.mError = kArgErrorBadSpec;
+
+    _.mArgs.assign(argv + commandArg, argv + argc);
+    _.mArgs[0] = _.mCommandName.c_str();
+
+    return _.mError = spec->Parse(int(_.mArgs.size()), _.mArgs.data());
+}
+
+int cArgSubcommands::Selected() const
+{
+    return _.mSelected;
+}
+
+int cArgSubcommands::Find(const char* name) const
+{
+    return _.Find(name, strlen(name));
+}
+
+int cArgSubcommands::NumCommands() const
+{
+    return int(_.mCommands.size());
+}
+
+const char* cArgSubcommands::Name(int index) const
+{
+    return (index >= 0 && index < NumCommands()) ? _.mCommands[index].mName : nullptr;
+}
+
+cArgSpec* cArgSubcommands::Spec(int index)
+{
+    if (index < 0 || index >= NumCommands())
+        return nullptr;
+
+    Internal::cCommand& command = _.mCommands[index];
+
+    if (!command.mSpec)
+    {
+        cAllocScope scope(_.mAllocator);
+        command.mSpec.reset(NewArg<cArgSpec>(_.mAllocator, _.mAllocator));
+
+        command.mSpecError = command.mFactory(command.mUserData, command.mSpec.get());
+        AS_ASSERT_F(command.mSpecError == kSpecNoError, "Bad spec for subcommand '%s': error %d\n", command.mName, command.mSpecError);
+    }
+
+    return command.mSpec.get();
+}
+
+const char* cArgSubcommands::ErrorString()
+{
+    if (_.mSelected >= 0 && (_.mError != kArgErrorBadSpec || _.mCommands[_.mSelected].mSpecError == kSpecNoError))
+        return Spec(_.mSelected)->ErrorString();    // including the spec's own kArgErrorBadSpec
+
+    cAllocScope scope(_.mAllocator);
+
+    switch (_.mError)
+    {
+    case kArgNoError:
+        _.mErrorString.clear();
+        break;
+    case kArgHelpRequested:
+        {
+            _.mErrorString.clear();
+            cHelpOutput out(AppendToString<tArgString>, &_.mErrorString);
+            _.WriteHelp(_.mToolName.c_str(), &out, kHelpFull);
+        }
+        break;
+    case kArgErrorUnknownOption:
+        Sprintf(&_.mErrorString, "Unknown option '%s': expecting a command, see '%s -h'", _.mArg, _.mToolName.c_str());
+        break;
+    case kArgErrorUnknownCommand:
+        Sprintf(&_.mErrorString, "Unknown command '%s', see '%s -h'", _.mArg, _.mToolName.c_str());
+        break;
+    case kArgErrorBadSpec:
+        Sprintf(&_.mErrorString, "Bad spec for subcommand '%s': error %d", _.mCommands[_.mSelected].mName, _.mCommands[_.mSelected].mSpecError);
+        break;
+    default:
+        Sprintf(&_.mErrorString, "Unknown error %d", _.mError);
+    }
+
+    return _.mErrorString.c_str();
+}
+
+void cArgSubcommands::CreateHelpString(const char* commandName, string* pString, tHelpType helpType) const
+{
+    pString->clear();
+    cHelpOutput out(AppendToString<string>, pString);
+    _.WriteHelp(commandName ? commandName : "", &out, helpType);
+}
+
+
+#ifndef _WIN32
+
+////////////////////////////////////////////////////////////////////////////////
+// cArgCommandProcessor
+//
+
+namespace
+{
+    const size_t kCommandReadSize  = 64 * 1024;    // per read() call
+    const size_t kMaxCommandLength = 1024 * 1024;  // longer commands are rejected
+    const size_t kMaxPendingOutput = 1024 * 1024;  // stop reading a client's commands while more replies than this are unsent
+}
+
+struct cArgCommandProcessor::Internal
+{
+    struct cClient
+    {
+        int          mInFD      = -1;
+        int          mOutFD     = -1;
+        bool         mOwnsFDs   = false;    // true for socket clients, whose single fd we close
+        bool         mOutSocket = false;    // mOutFD is a socket, so can be sent to with MSG_NOSIGNAL
+        bool         mInClosed  = false;
+        bool         mSkipping  = false;    // discarding the remainder of an overlong command
+        bool         mStalled   = false;    // commands remain in mIn, held back until mOut drains
+        vector<char> mIn;                   // mIn[0..mInSize) holds a partial command
+        size_t       mInSize    = 0;
+        string       mOut;                  // mOut[mOutSent..) is yet to be written
+        size_t       mOutSent   = 0;
+
+        size_t Pending() const { return mOut.size() - mOutSent; }
+    };
+
+    const cArgSpec&         mSpec;
+    tHandler*               mHandler;
+    void*                   mUserData;
+    string                  mCommandName;
+
+    cArgParseContext        mContext;
+    int                     mListenFD = -1;
+    string                  mSocketPath;
+    vector<cClient*>        mClients;
+    vector<pollfd>          mPollFDs;
+    vector<const char*>     mArgv;
+    string                  mReply;
+
+    Internal(const cArgSpec& spec, tHandler* handler, void* userData, const char* commandName) :
+        mSpec(spec),
+        mHandler(handler),
+        mUserData(userData),
+        mCommandName(commandName ? commandName : "")
+    {
+        mContext.SetResponseFiles(false);   // clients can't read the server's files,
+        mContext.SetEnvironment(false);     // or see its environment
+    }
+
+    ~Internal();
+
+    int  Poll(int timeoutMS);
+    void Accept();
+    bool Read(cClient* client, int* numCommands);
+    int  ProcessCommands(cClient* client, bool final);
+    void ProcessCommand(cClient* client, char* command, char* commandEnd);
+    bool Write(cClient* client);
+    void RemoveClient(size_t i);
+};
+
+cArgCommandProcessor::Internal::~Internal()
+{
+    for (size_t i = mClients.size(); i-- > 0; )
+        RemoveClient(i);
+
+    if (mListenFD >= 0)
     {
-        SprintfAppend(helpString, "\nTypes:");
-        AddEnumDocs(helpString, "    ", mEnumSpecs, helpType);
+        close(mListenFD);
+        unlink(mSocketPath.c_str());
     }
 }
 
-tArgError cArgSpec::Internal::ParseArgument(const cArgInfo& info, const char**& argv, const char** argvEnd)
+int cArgCommandProcessor::Internal::Poll(int timeoutMS)
 {
-    if (info.mFlagToSet >= 0)
-        mFlags |= 1 << info.mFlagToSet;
-
-    if (info.mType & kTypeArrayListFlag)
-    {
-        // We are making the assumption here that vector<> has the same layout and clear implementation for all types
-        static_cast<vector<int>*>(info.mLocation)->clear();
+    if (mClients.empty() && mListenFD < 0)
+        return -1;
 
-        do
-        {
-            if (IsOption(argv[0]))
-                return kArgNoError;
+    // Each client gets one entry for input, and an optional one for pending output
+    mPollFDs.clear();
 
-            tArgError error = ParseArrayArgument(info, argv, argvEnd);
+    if (mListenFD >= 0)
+        mPollFDs.push_back({ mListenFD, POLLIN, 0 });
 
-            if (error != kArgNoError)
-                return error;
-        }
-        while (argv < argvEnd);
+    for (cClient* client : mClients)
+    {
+        // Stop reading from a client that isn't reading its replies, to bound mOut
+        bool readable = !client->mInClosed && !client->mStalled && client->Pending() <= kMaxPendingOutput;
 
-        return kArgNoError;
+        mPollFDs.push_back({ readable ? client->mInFD : -1, POLLIN, 0 });
+        mPollFDs.push_back({ client->Pending() > 0 ? client->mOutFD : -1, POLLOUT, 0 });
     }
 
-    if (info.mType & kTypeArraySplitFlag)
-    {
-        tArgError err;
+    int numReady = poll(mPollFDs.data(), nfds_t(mPollFDs.size()), timeoutMS);
 
-        vector<const char*> arrayArgs;
-        Split(*argv++, &arrayArgs);
+    if (numReady < 0)
+        return errno == EINTR ? 0 : -1;
 
-        // We are making the assumption here that vector<> has the same layout and clear implementation for all types
-        if (info.mLocation)
-            static_cast<vector<int>*>(info.mLocation)->clear();
+    int numCommands = 0;
+    size_t first = mListenFD >= 0 ? 1 : 0;
+    size_t numClients = mClients.size();     // clients accepted below weren't polled
 
-        const char** aargv    = arrayArgs.data();
-        const char** aargvEnd = aargv + arrayArgs.size();
+    if (first && (mPollFDs[0].revents & POLLIN))
+        Accept();
 
-        while (aargv < aargvEnd)
-            if ((err = ParseArrayArgument(info, aargv, aargvEnd)) != kArgNoError)
-                return err;
+    for (size_t i = numClients; i-- > 0; )
+    {
+        cClient* client = mClients[i];
+        const pollfd& in  = mPollFDs[first + 2 * i];
+        const pollfd& out = mPollFDs[first + 2 * i + 1];
 
-        return kArgNoError;
-    }
+        bool ok = true;
 
-    switch (info.mType)
-    {
-    case kTypeBool:
-        return AS::Parse(static_cast<bool  *>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeInt:
-        return AS::Parse(static_cast<int   *>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeFloat:
-        return AS::Parse(static_cast<float *>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeDouble:
-        return AS::Parse(static_cast<double*>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeCString:
-        return AS::Parse(static_cast<const char**>(info.mLocation), *argv++, &mErrorString);
-    case kTypeString:
-        return AS::Parse(static_cast<string*>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeVec2:
-    case kTypeVec3:
-    case kTypeVec4:
-        return AS::Parse(2 + info.mType - kTypeVec2, static_cast<float*>(info.mLocation), argv, argvEnd, &mErrorString);
+        if (in.revents & (POLLIN | POLLHUP | POLLERR))
+            ok = Read(client, &numCommands);
 
-    default:
-        if (info.mType >= kTypeEnumBegin && size_t(info.mType - kTypeEnumBegin) < mEnumSpecs.size())
-        {
-            int enumIndex = info.mType - kTypeEnumBegin;
+        if (ok && client->Pending() > 0 && ((out.revents & POLLOUT) || out.fd < 0))
+            ok = Write(client);     // write new replies immediately, as the fd is likely ready
 
-            return AS::Parse(static_cast<int*>(info.mLocation), mEnumSpecs[enumIndex], *argv++,&mErrorString);
-        }
+        if (ok && client->mStalled && client->Pending() <= kMaxPendingOutput)
+            numCommands += ProcessCommands(client, client->mInClosed);   // resume commands held back
 
-        Sprintf(&mErrorString, "Unknown arg type %d", info.mType);
-        return kArgErrorBadSpec;
+        if (!ok || (client->mInClosed && !client->mStalled && client->Pending() == 0))
+            RemoveClient(i);
     }
+
+    return numCommands;
 }
 
-namespace
+void cArgCommandProcessor::Internal::Accept()
 {
-    typedef struct { float _[2]; } Vec2;
-    typedef struct { float _[3]; } Vec3;
-    typedef struct { float _[4]; } Vec4;
-
-    template<class T> tArgError Parse(vector<T>* location, const char* arg, string* errorString)
+    while (true)
     {
-        T result;
-
-        tArgError error = AS::Parse(&result, arg, errorString);
-        if (error != kArgNoError)
-            return error;
+        int fd = accept(mListenFD, nullptr, nullptr);
 
-        if (location)
-            location->push_back(result);
-
-        return error;
-    }
-
-    template<class T> tArgError Parse(vector<T>* location, const char**& argv, const char** argvEnd, string* errorString)
-    {
-        T result;
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;      // EAGAIN, or the client went away
+        }
 
-        tArgError error = AS::Parse(sizeof(T) / sizeof(T()._[0]), result._, argv, argvEnd, errorString);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-        if (error != kArgNoError)
-            return error;
+    #ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
 
-        if (location)
-            location->push_back(result);
+        cClient* client = new cClient;
+        client->mInFD = fd;
+        client->mOutFD = fd;
+        client->mOwnsFDs = true;
+        client->mOutSocket = true;
 
-        return error;
+        mClients.push_back(client);
     }
+}
 
-    template<class T> tArgError Parse(vector<T>* location, const cEnumSpec& enumSpec, const char* arg, string* errorString)
-    {
-        T result;
-
-        tArgError error = AS::Parse(&result, enumSpec, arg, errorString);
+bool cArgCommandProcessor::Internal::Read(cClient* client, int* numCommands)
+{
+    // Keep room for a full read plus the NUL that TokenizeInPlace may need
+    if (client->mIn.size() < client->mInSize + kCommandReadSize + 1)
+        client->mIn.resize(client->mInSize + kCommandReadSize + 1);
 
-        if (error != kArgNoError)
-            return error;
+    ssize_t result = read(client->mInFD, client->mIn.data() + client->mInSize, kCommandReadSize);
 
-        if (location)
-            location->push_back(result);
+    if (result < 0)
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
 
-        return error;
-    }
+    client->mInSize += size_t(result);
+    client->mInClosed = (result == 0);
 
+    *numCommands += ProcessCommands(client, client->mInClosed);
+    return true;
 }
 
-tArgError cArgSpec::Internal::ParseArrayArgument(const cArgInfo& info, const char**& argv, const char** argvEnd)
+int cArgCommandProcessor::Internal::ProcessCommands(cClient* client, bool final)
 {
-    int type = info.mType & kTypeBaseMask;
+    int numCommands = 0;
+    char* s   = client->mIn.data();
+    char* end = s + client->mInSize;
 
-    switch (type)
-    {
-    case kTypeBool:
-        return AS::Parse(static_cast<vector<bool>*>       (info.mLocation), *argv++, &mErrorString);
-    case kTypeInt:
-        return AS::Parse(static_cast<vector<int>*>        (info.mLocation), *argv++, &mErrorString);
-    case kTypeFloat:
-        return AS::Parse(static_cast<vector<float>*>      (info.mLocation), *argv++, &mErrorString);
-    case kTypeDouble:
-        return AS::Parse(static_cast<vector<double>*>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeCString:
-        return AS::Parse(static_cast<vector<const char*>*>(info.mLocation), *argv++, &mErrorString);
-    case kTypeString:
-        return AS::Parse(static_cast<vector<string>*>     (info.mLocation), *argv++, &mErrorString);
-    case kTypeVec2:
-        return AS::Parse(static_cast<vector<Vec2>*>       (info.mLocation), argv, argvEnd, &mErrorString);
-    case kTypeVec3:
-        return AS::Parse(static_cast<vector<Vec3>*>       (info.mLocation), argv, argvEnd, &mErrorString);
-    case kTypeVec4:
-        return AS::Parse(static_cast<vector<Vec4>*>       (info.mLocation), argv, argvEnd, &mErrorString);
+    client->mStalled = false;
 
-    default:
-        if (type >= kTypeEnumBegin && size_t(type - kTypeEnumBegin) < mEnumSpecs.size())
+    while (char* nl = static_cast<char*>(memchr(s, '\n', end - s)))
+    {
+        if (client->Pending() > kMaxPendingOutput)  // leave the rest until the client catches up
         {
-            int enumIndex = type - kTypeEnumBegin;
+            client->mStalled = true;
+            break;
+        }
 
-            return AS::Parse(static_cast<vector<int>*>(info.mLocation), mEnumSpecs[enumIndex], *argv++, &mErrorString);
+        if (client->mSkipping)
+            client->mSkipping = false;
+        else
+        {
+            ProcessCommand(client, s, nl);
+            numCommands++;
         }
 
-        Sprintf(&mErrorString, "Unknown array argument type %d", type);
-        return kArgErrorBadSpec;
+        s = nl + 1;
     }
-}
 
-tArgError cArgSpec::Internal::ParseOptionArgs(const vector<cArgInfo>& optArgs, const char**& argv, const char** argvEnd)
-{
-    size_t i = 0;
-    size_t n = optArgs.size();
+    if (final && s < end && !client->mSkipping && !client->mStalled)  // unterminated last command
+    {
+        *end = 0;
+        ProcessCommand(client, s, end);
+        numCommands++;
+        s = end;
+    }
 
-    while (argv < argvEnd && i < n && !IsOption(*argv))
+    if (client->mStalled)
+        ;   // what remains starts with complete commands, so keep it all
+    else if (size_t(end - s) > kMaxCommandLength)
     {
-        tArgError error = ParseArgument(optArgs[i], argv, argvEnd);
+        Sprintf(&mReply, "Command too long (limit is %zu bytes)\n", kMaxCommandLength);
+        client->mOut.append(mReply);
+        client->mSkipping = true;
+        s = end;
+    }
+    else if (client->mSkipping)
+        s = end;
 
-        if (error != kArgNoError)
-            return error;
+    // Move any partial command to the front
+    client->mInSize = end - s;
+    memmove(client->mIn.data(), s, client->mInSize);
 
-        i++;
-    }
+    return numCommands;
+}
 
-    if (i < n && optArgs[i].mIsRequired)
-    {
-        size_t numHave = i;
+void cArgCommandProcessor::Internal::ProcessCommand(cClient* client, char* command, char* commandEnd)
+{
+    if (commandEnd > command && commandEnd[-1] == '\r')
+        commandEnd--;
 
-        do
-            i++;
-        while (i < n && optArgs[i].mIsRequired);
+    mArgv.clear();
+    mArgv.push_back(mCommandName.c_str());
+
+    TokenizeInPlace(command, commandEnd, &mArgv);
 
-        Sprintf(&mErrorString, "Not enough arguments: expecting at least %d more", i - numHave);
+    if (mArgv.size() == 1)  // ignore blank lines
+        return;
+
+    mReply.clear();
 
-        return kArgErrorNotEnoughArgs;
+    if (mSpec.Parse(int(mArgv.size()), mArgv.data(), &mContext) == kArgNoError)
+    {
+        if (mHandler)
+            mHandler(mUserData, mSpec, &mContext, &mReply);
     }
+    else
+        mReply = mSpec.ErrorString(&mContext);
 
-    return kArgNoError;
+    if (!mReply.empty() && mReply.back() != '\n')
+        mReply += '\n';
+
+    client->mOut.append(mReply);
 }
 
-tArgError cArgSpec::Internal::ParseOption(const char**& argv, const char** argvEnd)
+bool cArgCommandProcessor::Internal::Write(cClient* client)
 {
-    const char* optionName = argv[0] + 1;
-
-    argv++;
-
-    if (optionName[0] == kOptionChar)   // handle '--option', and skip '--', used as an open-ended list terminator
+    if (client->mOutFD < 0)
     {
-        optionName++;
-        if (optionName[0] == 0)
-            return kArgNoError;
+        client->mOut.clear();
+        client->mOutSent = 0;
+        return true;
     }
 
-    for (size_t i = 0, n = mOptions.size(); i < n; i++)
+    while (client->mOutSent < client->mOut.size())
     {
-        if (Eq(optionName, "h"))
-            mHelpRequested = true;
+        const char* data = client->mOut.data() + client->mOutSent;
+        size_t size = client->mOut.size() - client->mOutSent;
 
-        if (Eq(mOptions[i].mName, optionName))
-        {
-            if (mOptions[i].mFlagToSet >= 0)
-                mFlags |= 1 << mOptions[i].mFlagToSet;
+    #ifdef MSG_NOSIGNAL
+        ssize_t result = client->mOutSocket ? send(client->mOutFD, data, size, MSG_NOSIGNAL) : write(client->mOutFD, data, size);
+    #else
+        ssize_t result = write(client->mOutFD, data, size);
+    #endif
 
-            tArgError err = ParseOptionArgs(mOptions[i].mArguments, argv, argvEnd);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
 
-            if (err != kArgNoError)
+            if (client->mOutSent >= client->Pending())  // drop what's sent once that's the bulk of mOut
             {
-                mErrorString += " in -";
-                mErrorString += optionName;
+                client->mOut.erase(0, client->mOutSent);
+                client->mOutSent = 0;
             }
 
-            return err;
+            return errno == EAGAIN || errno == EWOULDBLOCK;     // wait for POLLOUT
         }
-    }
 
-    if (mHelpRequested)
-        return kArgHelpRequested;
+        client->mOutSent += size_t(result);
+    }
 
-    Sprintf(&mErrorString, "Unknown option '%s'", optionName);
-    return kArgErrorUnknownOption;
+    client->mOut.clear();
+    client->mOutSent = 0;
+    return true;
 }
 
-void cArgSpec::Internal::AddArgDocs(string* helpString, const vector<cArgInfo>& args, tHelpType helpType) const
+void cArgCommandProcessor::Internal::RemoveClient(size_t i)
 {
-    int numClauses = 0;
+    cClient* client = mClients[i];
 
-    if (helpType == kHelpHTML)
-        helpString->append("<i>");
+    if (client->mOwnsFDs)
+        close(client->mInFD);
 
-    for (size_t i = 0, n = args.size(); i < n; i++)
-    {
-        const cArgInfo& ai = args[i];
+    delete client;
+    mClients.erase(mClients.begin() + i);
+}
 
-        if (i != 0)
-            helpString->append(" ");
 
-        if (!ai.mIsRequired)
-        {
-            helpString->push_back(kOpenBracketChar);
-            numClauses++;
-        }
+cArgCommandProcessor::cArgCommandProcessor(const cArgSpec& spec, tHandler* handler, void* userData, const char* commandName) :
+    _(*new Internal(spec, handler, userData, commandName))
+{
+}
 
-        if (helpType == kHelpHTML)
-            helpString->append("&lt;");
-        else if (helpType != kHelpMarkdown)
-            helpString->append("<");
+cArgCommandProcessor::~cArgCommandProcessor()
+{
+    delete &_;
+}
 
-        if (!ai.mName.empty())
-            SprintfAppend(helpString, "%s:", ai.mName.c_str());
+bool cArgCommandProcessor::AddClient(int inFD, int outFD)
+{
+    if (inFD < 0)
+        return false;
 
-        if (helpType == kHelpMarkdown)
-            helpString->append("_");
+    // Otherwise a client that stops reading or writing blocks the processor, and all other clients
+    fcntl(inFD, F_SETFL, fcntl(inFD, F_GETFL) | O_NONBLOCK);
 
-        SprintfAppend(helpString, "%s", NameFromArgType(ai.mType));
+    bool outSocket = false;
 
-        if (helpType == kHelpHTML)
-            helpString->append("&gt;");
-        else if (helpType == kHelpMarkdown)
-            helpString->append("_");
-        else
-            helpString->append(">");
+    if (outFD >= 0)
+    {
+        fcntl(outFD, F_SETFL, fcntl(outFD, F_GETFL) | O_NONBLOCK);
 
-        if (ai.mType & kTypeArrayListFlag)
-        {
-            helpString->append(" ");
-            helpString->append(kEllipsisToken);
-        }
+        struct stat info;
+        outSocket = fstat(outFD, &info) == 0 && S_ISSOCK(info.st_mode);
     }
 
-    for (int i = 0; i < numClauses; i++)
-        helpString->push_back(kCloseBracketChar);
+#ifdef MSG_NOSIGNAL
+    if (outFD >= 0 && !outSocket)
+#else
+    if (outFD >= 0)
+#endif
+    {
+        struct sigaction action;
 
-    if (helpType == kHelpHTML)
-        helpString->append("</i>");
+        if (sigaction(SIGPIPE, nullptr, &action) == 0 && action.sa_handler == SIG_DFL)
+            signal(SIGPIPE, SIG_IGN);
+    }
+
+    Internal::cClient* client = new Internal::cClient;
+    client->mInFD = inFD;
+    client->mOutFD = outFD;
+    client->mOutSocket = outSocket;
 
-    helpString->append("\n");
+    _.mClients.push_back(client);
+    return true;
 }
 
-void cArgSpec::Internal::FindNameAndTypeFromOption(const string& str, tArgType* type, string* name) const
+bool cArgCommandProcessor::Listen(const char* socketPath)
 {
-    (*name) = "";
-
-    if (str.empty())
-    {
-        *type = kTypeInvalid;
-        return;
-    }
-    if (str.size() > 1 && str[0] == kFormatChar)
-    {
-        switch (str[1])
-        {
-        case 'f':
-        case 'g':
-            *type = kTypeFloat;
-            break;
-        case 'F':
-        case 'G':
-            *type = kTypeDouble;
-            break;
-        case 'd':
-            *type = kTypeInt;
-            break;
-        case 'b':
-            *type = kTypeBool;
-            break;
-        case 's':
-            *type = kTypeCString;
-            break;
-        default:
-            *type = kTypeInvalid;
-        }
-    }
-    else
-    {
-        string typeStr(str);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
 
-        if (typeStr[0] == kBeginArgChar && typeStr[typeStr.size() - 1] == kEndArgChar)
-        {
-            typeStr.erase(typeStr.size() - 1, 1);
-            typeStr.erase(0, 1);
-        }
+    if (_.mListenFD >= 0 || strlen(socketPath) >= sizeof(address.sun_path))
+        return false;
 
-        size_t sepPos = typeStr.find(kArgSepChar);
-        if (sepPos != string::npos)
-        {
-            name->assign(typeStr, 0, sepPos);
-            typeStr = string(typeStr, sepPos + 1, string::npos);
-        }
+    strcpy(address.sun_path, socketPath);
 
-        (*type) = ArgTypeFromName(typeStr.c_str());
-    }
-}
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
 
-const char* cArgSpec::Internal::NameFromArgType(tArgType argType) const
-{
-    static string sResult;
+    if (fd < 0)
+        return false;
 
-    int baseArgType = argType & kTypeBaseMask;
+    unlink(socketPath);
 
-    switch (baseArgType)
+    if (bind(fd, (const sockaddr*) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
     {
-    case kTypeBool:
-        sResult = "bool";
-        break;
-    case kTypeInt:
-        sResult = "int";
-        break;
-    case kTypeFloat:
-        sResult = "float";
-        break;
-    case kTypeDouble:
-        sResult = "double";
-        break;
-    case kTypeCString:
-    case kTypeString:
-        sResult = "string";
-        break;
-
-    case kTypeVec2:
-        sResult = "vec2";
-        break;
-    case kTypeVec3:
-        sResult = "vec3";
-        break;
-    case kTypeVec4:
-        sResult = "vec4";
-        break;
-
-    case kTypeInvalid:
-        sResult = "invalid";
-        break;
-    default:
-        if (baseArgType >= kTypeEnumBegin && baseArgType < kTypeEnumEnd && size_t(baseArgType - kTypeEnumBegin) < mEnumSpecs.size())
-            sResult = mEnumSpecs[baseArgType - kTypeEnumBegin].mName;
-        else
-            sResult = "unknown";
+        close(fd);
+        return false;
     }
 
-    if (argType & (kTypeArraySplitFlag))
-        sResult += "[]";
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-    return sResult.c_str();
+    _.mListenFD = fd;
+    _.mSocketPath = socketPath;
+    return true;
 }
 
-tArgType cArgSpec::Internal::ArgTypeFromName(const char* typeName) const
+int cArgCommandProcessor::Poll(int timeoutMS)
 {
-    tArgType arrayFlag = tArgType(0);
-    size_t typeLen = strlen(typeName);
+    return _.Poll(timeoutMS);
+}
 
-    if (typeLen > 2 && typeName[typeLen - 2] == '[' && typeName[typeLen - 1] == ']')
-    {
-        arrayFlag = kTypeArraySplitFlag;
-        typeLen -= 2;
-    }
+int cArgCommandProcessor::Run()
+{
+    int total = 0;
 
-    if (Eq(typeName, "bool", typeLen))
-        return kTypeBool | arrayFlag;
-    if (Eq(typeName, "int", typeLen))
-        return kTypeInt | arrayFlag;
-    if (Eq(typeName, "float", typeLen))
-        return kTypeFloat | arrayFlag;
-    if (Eq(typeName, "double", typeLen))
-        return kTypeDouble | arrayFlag;
-    if (Eq(typeName, "string", typeLen))
-        return kTypeString | arrayFlag;
-    if (Eq(typeName, "cstr", typeLen) || Eq(typeName, "cstring", typeLen))
-        return kTypeCString | arrayFlag;
+    for (int numCommands; (numCommands = _.Poll(-1)) >= 0; )
+        total += numCommands;
 
-    if (typeName[0] == 'v')
-    {
-        if (Eq(typeName, "v2", typeLen) || Eq(typeName, "vec2", typeLen) || Eq(typeName, "vector2", typeLen))
-            return kTypeVec2 | arrayFlag;
-        if (Eq(typeName, "v3", typeLen) || Eq(typeName, "vec3", typeLen) || Eq(typeName, "vector3", typeLen))
-            return kTypeVec3 | arrayFlag;
-        if (Eq(typeName, "v4", typeLen) || Eq(typeName, "vec4", typeLen) || Eq(typeName, "vector4", typeLen))
-            return kTypeVec4 | arrayFlag;
-    }
+    return total;
+}
 
-    for (size_t i = 0, n = mEnumSpecs.size(); i < n; i++)
-        if (Eq(mEnumSpecs[i].mName, typeName))
-            return tArgType(kTypeEnumBegin + i) | arrayFlag;
+int cArgCommandProcessor::NumClients() const
+{
+    return int(_.mClients.size());
+}
 
-    AS_ASSERT_F(0, "bad argument spec type\n");
-    return kTypeInvalid;
+cArgParseContext* cArgCommandProcessor::Context()
+{
+    return &_.mContext;
 }
 
+#endif
+
 }
 
 #ifdef _MSC_VER
@@ -1288,5 +5698,8 @@ tArgType cArgSpec::Internal::ArgTypeFromName(const char* typeName) const
     #undef strncasecmp
 #endif
 
+#undef AS_SSE2
+#undef AS_AVX2
+
 #endif
 
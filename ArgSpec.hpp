@@ -9,8 +9,15 @@
 #ifndef ARG_SPEC_H
 #define ARG_SPEC_H
 
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 #ifndef AS_ASSERT
     #ifndef NDEBUG
@@ -23,6 +30,10 @@
     #endif
 #endif
 
+#ifndef AS_INSTRUMENT
+    #define AS_INSTRUMENT 0     ///< Set to 1 to compile in parse instrumentation, see cArgSpec::EnableStats()
+#endif
+
 namespace AS
 {
     using std::string;
@@ -47,6 +58,11 @@ namespace AS
         kArgErrorUnknownOption,
         kArgErrorBadEnum,
         kArgErrorGarbage,
+        kArgErrorResponseFile,
+        kArgErrorRange,
+        kArgErrorAmbiguousOption,
+        kArgErrorUnknownCommand,    ///< from cArgSubcommands, no subcommand of the given name
+        kArgErrorConfigFile,        ///< config file couldn't be read, or has a line that isn't "name = values"
         kNumArgErrors
     };
     
@@ -56,15 +72,266 @@ namespace AS
         kSpecUnbalancedBrackets,   ///< unbalanced [/]
         kSpecEllipsisError,        ///< unexpected ...
         kSpecUnknownType,          ///< unrecognized argument type
+        kSpecBadFormat,            ///< serialized spec is missing, corrupt, or from an incompatible version
+        kSpecBadBindings,          ///< too few bindings supplied for serialized spec
+        kSpecTypeMismatch,         ///< variable type doesn't match the spec, or arguments are missing
+        kSpecBadEnumFile,          ///< @enum dictionary file couldn't be read, or is malformed
+        kSpecShared,               ///< spec is shared with a clone, or rebound, so can't be appended to
+        kSpecBadEnvVar,            ///< $NAME following an option name isn't a valid environment variable name
         kNumSpecErrors
     };
 
+    enum tParsePhase : int
+    {
+        kPhaseResponseFiles,    ///< @file expansion
+        kPhaseLookup,           ///< option name lookup
+        kPhaseConvert,          ///< conversion of single values
+        kPhaseArrays,           ///< conversion of list and split array arguments
+        kPhaseReport,           ///< generation of error strings and help
+        kNumParsePhases
+    };
+
+    enum tStatsFormat : int
+    {
+        kStatsText,             ///< Human-readable summary
+        kStatsPrometheus,       ///< Prometheus text exposition format, e.g., for node_exporter's textfile collector
+        kNumStatsFormats
+    };
+
+    enum tCompletionShell : int
+    {
+        kShellBash,             ///< bash, via complete -F
+        kShellZsh,              ///< zsh, via compdef
+        kNumCompletionShells
+    };
+
     struct cArgEnumInfo
     {
         const char* mToken;
         int         mValue;
     };
 
+    enum tSpecItemType : uint8_t
+    {
+        kItemEnd,           ///< no more items
+        kItemNull,          ///< nullptr
+        kItemValue,         ///< integer or enum value, e.g., a flag
+        kItemString,        ///< const char*
+        kItemEnumInfo,      ///< cArgEnumInfo table
+
+        // Pointers to variables
+        kItemBoolPtr,
+        kItemIntPtr,
+        kItemEnumPtr,       ///< enum variable
+        kItemFloatPtr,
+        kItemDoublePtr,
+        kItemCStringPtr,
+        kItemStringPtr,
+        kItemFloat2Ptr,     ///< float[2], a struct of two floats, or an IsFloatVector type of that size
+        kItemFloat3Ptr,
+        kItemFloat4Ptr,
+        kItemUnknownPtr,    ///< void*, or passed via va_list: not checked
+        kItemOther,         ///< anything else
+
+        kItemVectorOf = 0x40    ///< flag: pointer to a vector of the given type
+    };
+
+    template<class T> struct IsFloatVector : std::false_type {};
+    ///< Specialize as std::true_type for a vector class that isn't a plain struct of floats, e.g., because it
+    ///< has constructors, so it can be bound to <vec2>, <vec3>, or <vec4> according to its size.
+
+    struct cSpecItem
+    /// An argument to ConstructSpec(), tagged with its type, so it can be checked against the spec.
+    {
+        tSpecItemType   mType    = kItemEnd;
+        int             mValue   = 0;           ///< for kItemValue
+        const void*     mPointer = nullptr;     ///< for everything else
+
+        cSpecItem() = default;
+        cSpecItem(tSpecItemType type, int value, const void* pointer) : mType(type), mValue(value), mPointer(pointer) {}
+    };
+
+
+    struct cArgErrorInfo
+    /// Structured result of Parse(). This is cheap to record, and ErrorString() is only generated from it on demand.
+    {
+        tArgError   mError      = kArgNoError;
+        int         mArgIndex   = -1;   ///< Index into argv, after any @file expansion, of the offending argument, or argc if more were expected
+        int         mOffset     = 0;    ///< Byte offset of the offending value within that argument, e.g., for <int[]>
+        int         mLength     = -1;   ///< Length of the offending value, or -1 for the rest of the argument
+        int         mOption     = -1;   ///< Index of the option being parsed, in spec order, or -1 for main arguments
+        int         mExpected   = 0;    ///< Number of arguments expected, for kArgErrorNotEnoughArgs/kArgErrorTooManyArgs
+        int         mType       = 0;    ///< Internal type of the argument being parsed, if any
+        int         mLine       = 0;    ///< Line of the config file the error is on, if non-zero, in which case mArgIndex indexes that line's values
+    };
+
+
+    class cArgAllocator
+    /// Source of memory for a cArgSpec or cArgParseContext, e.g., so they can be used without touching the
+    /// global heap. Allocate() must return memory aligned for any type, or nullptr if it's out of memory.
+    {
+    public:
+        virtual void* Allocate(size_t size) = 0;
+        virtual void  Free(void* p, size_t size) = 0;
+
+    protected:
+        ~cArgAllocator() = default;
+    };
+
+    class cArgArena : public cArgAllocator
+    /** Monotonic allocator. Free() only reclaims the most recent allocation,
+        otherwise memory is held until Reset() or destruction. Given a buffer,
+        the arena has a fixed capacity, and fails allocations once that's used
+        up. Otherwise it grows by allocating blocks from the parent allocator,
+        or the heap. Use PeakBytesUsed() to size a fixed-capacity arena.
+    */
+    {
+    public:
+        cArgArena(void* buffer, size_t capacity);
+        explicit cArgArena(size_t blockSize = 64 * 1024, cArgAllocator* parent = nullptr);
+        cArgArena(const cArgArena&) = delete;
+        cArgArena& operator=(const cArgArena&) = delete;
+        ~cArgArena();
+
+        void*  Allocate(size_t size) override;
+        void   Free(void* p, size_t size) override;
+
+        void   Reset();
+        ///< Release everything allocated so far. Anything using the arena must be destroyed first.
+        size_t BytesUsed() const;
+        ///< Returns bytes currently allocated.
+        size_t PeakBytesUsed() const;
+        ///< Returns the most bytes allocated at any one time.
+        size_t Capacity() const;
+        ///< Returns total bytes available, including those in use.
+
+    protected:
+        struct cBlock;
+
+        cArgAllocator*  mParent    = nullptr;
+        cBlock*         mBlocks    = nullptr;  ///< blocks allocated from mParent, most recent first
+        char*           mBuffer    = nullptr;  ///< fixed-capacity buffer, if any
+        char*           mCursor    = nullptr;
+        char*           mEnd       = nullptr;
+        size_t          mBlockSize = 0;
+        size_t          mCapacity  = 0;
+        size_t          mUsed      = 0;
+        size_t          mPeak      = 0;
+    };
+
+    void* ArgAllocate(cArgAllocator* allocator, size_t size);
+    ///< Allocate via 'allocator', or the heap if it's null, throwing std::bad_alloc on failure.
+    void  ArgFree(cArgAllocator* allocator, void* p, size_t size);
+    ///< Free memory returned by ArgAllocate().
+    cArgAllocator* CurrentArgAllocator();
+    ///< Returns the allocator of the cArgSpec call in progress on this thread, if any.
+
+    template<class T> struct cArgAlloc
+    /// Standard allocator adaptor for cArgAllocator, used by all internal containers. A default-constructed
+    /// one uses the allocator of the cArgSpec call in progress, so temporaries follow the spec's allocator.
+    {
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_copy_assignment;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        cArgAllocator* mAllocator;
+
+        cArgAlloc() : mAllocator(CurrentArgAllocator()) {}
+        explicit cArgAlloc(cArgAllocator* allocator) : mAllocator(allocator) {}
+        template<class U> cArgAlloc(const cArgAlloc<U>& other) : mAllocator(other.mAllocator) {}
+
+        T*   allocate(size_t n)          { return static_cast<T*>(ArgAllocate(mAllocator, n * sizeof(T))); }
+        void deallocate(T* p, size_t n)  { ArgFree(mAllocator, p, n * sizeof(T)); }
+    };
+
+    template<class T, class U> bool operator==(const cArgAlloc<T>& a, const cArgAlloc<U>& b) { return a.mAllocator == b.mAllocator; }
+    template<class T, class U> bool operator!=(const cArgAlloc<T>& a, const cArgAlloc<U>& b) { return a.mAllocator != b.mAllocator; }
+
+    typedef std::basic_string<char, std::char_traits<char>, cArgAlloc<char>> tArgString;
+    template<class T> using tArgVector = std::vector<T, cArgAlloc<T>>;
+
+
+    struct cArgParseStats
+    /// Snapshot of parse instrumentation, as returned by cArgSpec::GetStats(). Times are in nanoseconds.
+    {
+        uint64_t        mNumParses  = 0;    ///< Calls to Parse()
+        uint64_t        mNumErrors  = 0;    ///< Calls that returned an error other than kArgHelpRequested
+        uint64_t        mNumTokens  = 0;    ///< Arguments consumed, after @file expansion
+        uint64_t        mParseNS    = 0;    ///< Total time spent in Parse()
+        uint64_t        mPhaseNS[kNumParsePhases] = {};     ///< Time spent in each tParsePhase
+        vector<uint64_t> mOptionHits;       ///< Times each option was given, in spec order
+        vector<string>  mOptionNames;       ///< Corresponding option names
+    };
+
+
+    class cArgParseContext
+    /** Holds the per-call state of cArgSpec::Parse(): flags, error results,
+        and scratch space. By giving each thread its own context, a single
+        cArgSpec can be used to parse concurrently without locking, as the
+        spec itself is only read.
+    */
+    {
+    public:
+        explicit cArgParseContext(cArgAllocator* allocator = nullptr);
+        ///< Per-call state is allocated via 'allocator', or the heap if it's null.
+        cArgParseContext(const cArgParseContext&) = delete;
+        cArgParseContext& operator=(const cArgParseContext&) = delete;
+        cArgParseContext(cArgParseContext&& other);
+        cArgParseContext& operator=(cArgParseContext&& other);
+        ///< Moves take over any @file buffers, so string values from the last Parse() remain valid.
+        ~cArgParseContext();
+
+        bool Flag(int flag) const;
+        ///< Returns value of given flag, as set by Parse().
+        void SetFlag(int flag);
+        ///< Set the given flag.
+        bool AnyFlags(const uint64_t mask[], int numWords) const;
+        ///< Returns true if any of the flags in 'mask' are set, where flag f is bit f % 64 of mask[f / 64].
+        const uint64_t* FlagWords(int* numWords) const;
+        ///< Returns all flags, laid out as for AnyFlags(), and valid until the next Parse().
+
+        const cArgErrorInfo& ErrorInfo() const;
+        ///< Returns results of the last Parse() using this context.
+
+        void Bind(void* const bindings[], int numBindings);
+        ///< Redirect parsed values to the given variables, indexed as for cArgSpec::LoadSpec(), rather than
+        ///< those bound by the spec itself. Pass nullptr to revert.
+        void SetResponseFiles(bool enabled);
+        ///< Enable or disable expansion of @file arguments, which is on by default.
+        void SetEnvironment(bool enabled);
+        ///< Enable or disable applying environment variables bound by "-option $VAR", which is off by default.
+        void SetConfigFile(const char* path);
+        ///< Have Parse() first apply the given INI-style file, of "option = values" lines, as for cArgSpec. Pass
+        ///< nullptr to stop.
+
+    protected:
+        friend class cArgSpec;
+
+        void ReleaseFiles();
+
+        cArgAllocator*      mAllocator;
+        tArgVector<uint64_t> mFlags;        ///< bitset, sized to the spec's highest flag by Parse()
+        bool                mHelpRequested  = false;
+        bool                mResponseFiles  = true;
+        bool                mEnvironment    = false;
+        cArgErrorInfo       mError;
+        int                 mArgc           = 0;    ///< argc/argv of the last Parse(), for ErrorString()
+        const char**        mArgv           = nullptr;
+        void* const*        mBindings       = nullptr;
+        int                 mNumBindings    = 0;
+        tArgVector<tArgVector<char>> mScratch;  ///< copies of <cstr[]> arguments, as split in place
+        tArgVector<const char*> mArgs;      ///< argv after @file expansion
+        tArgVector<const char*> mFileTokens; ///< tokens of @files being expanded
+        tArgVector<void*>   mFiles;         ///< @files referenced by mArgs, kept until the next Parse()
+        tArgVector<const char*> mValueTokens; ///< tokens of the environment or config value being parsed
+        const char*         mEnvVar         = nullptr;  ///< environment variable the error came from, if any
+        tArgVector<int>     mEnvErrors;     ///< options whose environment value didn't parse, unless the command line gives them
+        tArgString          mConfigPath;    ///< config file applied by Parse(), if not empty
+        tArgString          mErrorString;
+        bool                mErrorStringValid = true;
+    };
+
 
     class cArgSpec
     /** Provides a specification for how to parse a command line,
@@ -117,15 +384,71 @@ namespace AS
     {
     public:
         // Creators
-        cArgSpec();
+        explicit cArgSpec(cArgAllocator* allocator = nullptr);
+        ///< All memory used by the spec, its help, and the default parse context comes from 'allocator' if
+        ///< given, e.g., a cArgArena, rather than the heap. Bound string and vector variables are the caller's.
+        cArgSpec(cArgSpec&& other);
+        cArgSpec& operator=(cArgSpec&& other);
+        ///< Moves just transfer ownership, so specs can be kept in containers. A moved-from spec may only be
+        ///< destroyed or assigned to.
         ~cArgSpec();
 
         // cArgSpec
-        tArgSpecError ConstructSpec(const char* briefDescription, ...);
+        template<class... T_ARGS> tArgSpecError ConstructSpec(const char* briefDescription, const T_ARGS&... args);
         ///< Construct the specification, binding arguments to variables. After this, Parse() may be called repeatedly.
+        ///< Variable types are checked against the spec, returning kSpecTypeMismatch if they don't agree, in
+        ///< which case Parse() fails with kArgErrorBadSpec. Wrap specs in AS_ARGS() to catch this at compile time.
+        template<class... T_ARGS> tArgSpecError AppendSpec(const char* spec, const T_ARGS&... args);
+        ///< Append further argument, option or enum specifications to the current spec, in the same format as
+        ///< ConstructSpec() minus the description, again terminated by nullptr. Useful for generated specs.
+
+        tArgSpecError ConstructSpecItems(const char* briefDescription, const cSpecItem items[], int numItems);
+        tArgSpecError AppendSpecItems(const cSpecItem items[], int numItems);
+        ///< Versions of the above taking pre-tagged arguments, as used by the templates.
+        tArgSpecError ConstructSpecV(const char* briefDescription, va_list args);
+        tArgSpecError AppendSpecV(const char* spec, va_list args);
+        ///< C varargs versions of the above, e.g., for wrappers. Variable types can't be checked.
+
+        void SaveSpec(vector<char>* data) const;
+        ///< Serialize the constructed spec, minus its bound variables, into a versioned, checksummed,
+        ///< position-independent form.
+        tArgSpecError LoadSpec(const void* data, size_t size, void* const bindings[], int numBindings);
+        ///< Load a spec written by SaveSpec(), without re-tokenizing. Variables are bound by index, in the order
+        ///< they were originally passed to ConstructSpec(). Enum tokens are referenced in place, so 'data' must
+        ///< outlive the spec. Data that fails its checksum is rejected with kSpecBadFormat.
+        tArgSpecError LoadSpecFile(const char* path, void* const bindings[], int numBindings);
+        ///< As for LoadSpec(), but memory-maps the given file read-only, so it can be shared between processes.
+        int NumBindings() const;
+        ///< Returns number of variables bound by the spec.
+
+        tArgSpecError Clone(const cArgSpec& spec, void* const bindings[] = nullptr, int numBindings = 0);
+        ///< Share the given spec, rather than constructing a new one, binding it to the given variables, indexed
+        ///< as for LoadSpec(), or else to spec's own. This costs O(NumBindings()), however large the spec. Shared
+        ///< specs are immutable: AppendSpec() returns kSpecShared, while ConstructSpec() and LoadSpec() replace
+        ///< this copy's spec without affecting others. Flags and errors are always per copy.
+        tArgSpecError Clone(const cArgSpec& spec, const void* fromObject, void* toObject, size_t objectSize);
+        ///< As above, but variables lying within fromObject[0, objectSize) are rebound to the same offsets in
+        ///< toObject, e.g., so a class holding a cArgSpec bound to its members can share one across instances.
+
+        void SetArraySeparators(const char* separators);
+        ///< Set the characters that separate the elements of <type[]> arguments, by default " \t". E.g., use
+        ///< " \t," to also allow "1,2,3". Up to four separators are matched 16-32 bytes at a time.
 
         tArgError Parse(int argc, const char** argv);
-        ///< Parse C-style args according to the previously set specification.
+        ///< Parse C-style args according to the previously set specification. An argument of the form @file
+        ///< is replaced by the white-space separated arguments in that file, which is mapped and tokenized in
+        ///< place, so string values remain valid until the next Parse().
+        tArgError Parse(int argc, const char** argv, cArgParseContext* context) const;
+        ///< Parse using the given context for all per-call state, leaving the spec itself untouched. As long as
+        ///< each thread uses its own context, this may be called concurrently.
+        void SetEnvironment(bool enabled);
+        ///< Have Parse() apply any environment variables bound to options by "-option $VAR", after any config
+        ///< file and before the command line. This scans environ, so is off by default.
+        void SetConfigFile(const char* path);
+        ///< Have Parse() first apply the given file of "option = values" lines, e.g., "size = 10 20" for -size,
+        ///< which is memory-mapped and parsed in place. Values are split only if the option takes more than one,
+        ///< blank lines, [sections] and lines starting with # or ; are skipped, and the environment and command
+        ///< line override it. Errors give ErrorInfo().mLine. Pass nullptr to stop.
 
         bool Flag(int flag) const;
         ///< Returns value of given flag, set by Parse(). All flags are cleared before Parse() does its job.
@@ -134,18 +457,524 @@ namespace AS
         ///< Set the given flag. Generally flags are set by this class as the result of a Parse() call,
         ///< but it is occasionally useful to set them externally during post-Parse() processing.
 
+        bool AnyFlags(const uint64_t mask[], int numWords) const;
+        ///< Returns true if any flag in the given bitset is set, where flag f is bit f % 64 of mask[f / 64].
+        const uint64_t* FlagWords(int* numWords) const;
+        ///< Returns the flags set by Parse() as a bitset, laid out as for AnyFlags(), for bulk dispatch.
+
         void CreateHelpString(const char* commandName, string* pString, tHelpType helpType = kHelpFull) const;
         ///< Create the given kind of help in pString.
+
+        typedef void tHelpWriter(void* userData, const char* data, size_t size);
+        void WriteHelp(const char* commandName, tHelpType helpType, tHelpWriter* writer, void* userData = nullptr) const;
+        ///< Stream the given kind of help to 'writer', in chunks of at most a few KB, other than for any longer
+        ///< doc strings. Help is never held in full, so this suits large specs and HTML/Markdown output.
+        void WriteHelp(const char* commandName, tHelpType helpType, FILE* file) const;
+        ///< As above, writing to the given file, e.g., stdout.
+    #ifndef _WIN32
+        void WriteHelp(const char* commandName, tHelpType helpType, int fd) const;
+        ///< As above, writing directly to the given file descriptor, e.g., a socket.
+    #endif
         const char* HelpString(const char* commandName, tHelpType helpType = kHelpFull) const;
-        ///< Return given type of help: this also sets ResultString().
+        ///< Return given type of help. This is rendered once per type and command name, and remains valid
+        ///< until the spec is changed. It's safe to call concurrently with itself and Parse().
+
+        int Complete(int argc, const char** argv, int index, vector<string>* completions, string* hint = nullptr) const;
+        ///< For tab completion: set 'completions' to the possible values of the partial argument argv[index],
+        ///< which may be argc for a new one. These are option names, or tokens of an enum argument expected at
+        ///< that position, whose type is given by 'hint', e.g., "<count:int>". Names come from an index built on
+        ///< first use, so each query costs O(log n) plus the number of matches. Returns completions->size().
+        bool WriteCompletions(int argc, const char** argv, FILE* file = stdout) const;
+        ///< If argv is "tool --complete index words...", as run by CreateCompletionScript()'s script, write the
+        ///< completions of words[index] to 'file', one per line, followed by any hint, and return true. Call
+        ///< this before any other setup in main(), to keep completion fast. An invalid index completes nothing.
+        void CreateCompletionScript(const char* commandName, string* script, tCompletionShell shell = kShellBash) const;
+        ///< Create a bash or zsh script completing commandName via WriteCompletions(), e.g., for "source <(tool
+        ///< --completion-script)".
         
         const char* ErrorString();
-        ///< Returns description of the results of the last call to Parse().
+        ///< Returns description of the results of the last call to Parse(). This is created on demand from
+        ///< ErrorInfo(), so the argv given to Parse() must still be valid.
+        const cArgErrorInfo& ErrorInfo() const;
+        ///< Returns the results of the last call to Parse() in structured form.
+        const char* ErrorString(cArgParseContext* context) const;
+        ///< Returns description of the results of the last Parse() using the given context.
+
+        bool EnableStats(bool enabled);
+        ///< Start or stop collecting parse statistics, across all contexts. Returns false if the library
+        ///< wasn't built with AS_INSTRUMENT, in which case the hooks compile away entirely.
+        void GetStats(cArgParseStats* stats) const;
+        ///< Fill in a snapshot of the statistics so far. This may be called while other threads are parsing.
+        void ResetStats();
+        ///< Zero all statistics.
+        void CreateStatsString(const char* commandName, string* pString, tStatsFormat format = kStatsText) const;
+        ///< Write the current statistics in the given format, labelled with the given command name.
+        bool WriteStatsFile(const char* commandName, const char* path, tStatsFormat format = kStatsText) const;
+        ///< As above, but to the given file. This is written to a temporary first and then renamed, so
+        ///< scrapers never see a partial file.
         
+    protected:
+        bool Shared() const;
+        void Unshare();
+
+        struct Internal;
+        Internal*           _;          ///< the spec proper, shared between clones
+        cArgParseContext    mContext;   ///< used by the non-context versions of Parse() etc.
+        tArgVector<void*>   mBindings;  ///< our own variables, if rebound via Clone()
+    };
+
+
+    class cArgSubcommands
+    /** Registry of subcommands, for git-style tools with many subcommands in
+        one binary, each with its own cArgSpec. A subcommand is registered by
+        name with a brief description and a factory that constructs its spec.
+        That is only called if the subcommand is selected, so startup cost
+        doesn't grow with the number of subcommands, and top-level help is
+        generated from the brief descriptions alone.
+
+            tArgSpecError ConstructCommit(void* userData, cArgSpec* spec)
+            {
+                cCommitOptions* options = (cCommitOptions*) userData;
+                return spec->ConstructSpec("Record changes", "-m <string>", &options->mMessage, "Message", nullptr);
+            }
+
+            cArgSubcommands commands("Version control");
+            commands.Add("commit", "Record changes", ConstructCommit, &commitOptions);
+            ...
+            if (commands.Parse(argc, argv) != kArgNoError)
+                printf("%s\n", commands.ErrorString());
+            else if (commands.Selected() == commands.Find("commit"))
+                ...
+
+        For busybox-style multi-call binaries, if the basename of argv[0]
+        names a subcommand, that is selected, and argv[1] onwards parsed by it.
+    */
+    {
+    public:
+        typedef tArgSpecError tFactory(void* userData, cArgSpec* spec);
+        ///< Constructs a subcommand's spec, e.g., via ConstructSpec(). Called at most once per subcommand.
+
+        explicit cArgSubcommands(const char* briefDescription, cArgAllocator* allocator = nullptr);
+        ~cArgSubcommands();
+        cArgSubcommands(const cArgSubcommands&) = delete;
+        cArgSubcommands& operator=(const cArgSubcommands&) = delete;
+
+        int Add(const char* name, const char* briefDescription, tFactory* factory, void* userData = nullptr);
+        ///< Register a subcommand, returning its index. The strings are referenced rather than copied, so should
+        ///< be literals or otherwise outlive the registry. If a name is repeated, the first registration wins.
+
+        tArgError Parse(int argc, const char** argv);
+        ///< Select a subcommand via argv[0]'s basename, or else argv[1], which is found in O(1), construct its
+        ///< spec if need be, and parse the remaining arguments with it. Returns kArgHelpRequested if no
+        ///< subcommand is given, or for -h, kArgErrorUnknownCommand if none matches, and kArgErrorBadSpec if the
+        ///< selected subcommand's factory failed, or its spec has mismatched variable types.
+        int Selected() const;
+        ///< Returns the index of the subcommand selected by the last Parse(), or -1.
+
+        int Find(const char* name) const;
+        ///< Returns the index of the named subcommand, or -1.
+        int NumCommands() const;
+        const char* Name(int index) const;
+        ///< Returns the name of the given subcommand.
+        cArgSpec* Spec(int index);
+        ///< Returns the given subcommand's spec, constructing it if it hasn't been yet, e.g., for Flag() after
+        ///< Parse(). Returns nullptr for an invalid index.
+
+        const char* ErrorString();
+        ///< Returns description of the results of the last Parse(): top-level help, an unknown-command error,
+        ///< or the selected subcommand's ErrorString().
+        void CreateHelpString(const char* commandName, string* pString, tHelpType helpType = kHelpFull) const;
+        ///< Create top-level help, listing subcommands and their brief descriptions, without constructing specs.
+
     protected:
         struct Internal;
         Internal&   _;
     };
+
+
+#ifndef _WIN32
+    class cArgCommandProcessor
+    /** Streaming front end for a cArgSpec, for use as a service's command
+        console. Reads newline-delimited commands from file descriptors,
+        pipes, or clients of a local Unix socket, tokenizes them in place,
+        and parses each via the spec. Commands that parse are passed to the
+        handler, and its reply written back to the client, as is the error
+        string of any that don't.
+
+        All clients are multiplexed on the calling thread via poll(), and
+        reads and writes are batched, so many commands are handled per system
+        call. @file arguments are not expanded, as they would give clients
+        access to local files.
+    */
+    {
+    public:
+        typedef void tHandler(void* userData, const cArgSpec& spec, cArgParseContext* context, string* reply);
+        ///< Called for each command that parses successfully. Anything appended to 'reply' is sent back to the
+        ///< client, followed by a newline if it lacks one. cstr arguments are only valid during the call.
+
+        cArgCommandProcessor(const cArgSpec& spec, tHandler* handler, void* userData = nullptr, const char* commandName = "");
+        ~cArgCommandProcessor();
+        cArgCommandProcessor(const cArgCommandProcessor&) = delete;
+        cArgCommandProcessor& operator=(const cArgCommandProcessor&) = delete;
+
+        bool AddClient(int inFD, int outFD = -1);
+        ///< Read commands from inFD, writing any replies to outFD, e.g., AddClient(0, 1) for stdin/stdout.
+        ///< These descriptors are not closed by the processor, but are made non-blocking, and if outFD isn't a
+        ///< socket, SIGPIPE is ignored if it was at its default, so a departed reader can't kill the process.
+        bool Listen(const char* socketPath);
+        ///< Accept clients on a Unix domain socket at the given path, replacing any stale socket file there.
+
+        int Poll(int timeoutMS = -1);
+        ///< Wait up to timeoutMS for activity, and process all complete commands received. Returns the number
+        ///< of commands processed, or -1 if there are no clients left and nothing listening.
+        int Run();
+        ///< Call Poll() until it returns -1. Returns the total number of commands processed.
+
+        int NumClients() const;
+        ///< Returns number of currently connected clients.
+        cArgParseContext* Context();
+        ///< Returns the context commands are parsed with, e.g., to Bind() variables.
+
+    protected:
+        struct Internal;
+        Internal&   _;
+    };
+#endif
+
+
+    // Compile-time spec checking. This validates spec strings only: ConstructSpec() still builds its tables at
+    // run time.
+
+    constexpr tArgSpecError CheckSpec(const char* spec);
+    ///< Returns the first error in the given argument or option spec string, e.g., "-scale %f [%f %f^]". This
+    ///< can be evaluated at compile time, but as it sees only the one string, it can't tell whether a <type>
+    ///< name refers to an enum: those are still checked by ConstructSpec().
+
+    template<tArgSpecError T_ERROR> struct cCheckedSpec;    ///< Only defined for kSpecNoError, so errors fail to compile
+    template<> struct cCheckedSpec<kSpecNoError> { static constexpr bool kValid = true; };
+
+    #define AS_SPEC(M_SPEC) (AS::cCheckedSpec<AS::CheckSpec(M_SPEC)>::kValid ? (M_SPEC) : nullptr)
+    ///< Use as AS_SPEC("-size %d") within ConstructSpec() to validate the given spec string at compile time.
+    ///< A bad spec fails with an incomplete cCheckedSpec<kSpecXXX> type naming the error.
+
+    constexpr tArgSpecError CheckSpecTypes(const char* spec, const tSpecItemType types[]);
+    ///< As for CheckSpec(), but also checks the spec against the types of the items that follow it, up to
+    ///< its description, which must be terminated by kItemEnd.
+
+    #define AS_ARGS(M_SPEC, ...) \
+        (AS::cCheckedSpec<AS::CheckSpecTypes(M_SPEC, decltype(AS::Typed::ItemTypes(__VA_ARGS__))::kTypes)>::kValid ? (M_SPEC) : nullptr), __VA_ARGS__
+    ///< Use as AS_ARGS("-size^ %d", kSizeFlag, &size), "Description", ... within ConstructSpec() to check both
+    ///< the spec string and the types of the variables and flags bound to it at compile time.
+
+
+    // Inlines
+
+    namespace Check
+    // C++11 constexpr is limited to single expressions, hence the recursive helpers.
+    {
+        constexpr bool IsSpace(char c)
+        { return c == ' ' || c == '\t' || c == '\n'; }
+
+        constexpr bool IsAlpha(char c)
+        { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+        constexpr bool IsIdent(char c)
+        { return IsAlpha(c) || (c >= '0' && c <= '9') || c == '_'; }
+
+        constexpr bool IsFormat(char c)
+        { return c == 'f' || c == 'g' || c == 'F' || c == 'G' || c == 'd' || c == 'b' || c == 's'; }
+
+        constexpr const char* SkipSpace(const char* s)
+        { return IsSpace(*s) ? SkipSpace(s + 1) : s; }
+
+        constexpr const char* TokenEnd(const char* s)
+        { return (*s == 0 || IsSpace(*s)) ? s : TokenEnd(s + 1); }
+
+        constexpr const char* Find(const char* s, const char* e, char c)
+        { return (s == e || *s == c) ? s : Find(s + 1, e, c); }
+
+        constexpr bool AllIdent(const char* s, const char* e)
+        { return s == e || (IsIdent(*s) && AllIdent(s + 1, e)); }
+
+        constexpr bool IsEllipsis(const char* s, const char* e)
+        { return e - s == 3 && s[0] == '.' && s[1] == '.' && s[2] == '.'; }
+
+        constexpr tArgSpecError TypeName(const char* s, const char* e)
+        {
+            return (e - s > 2 && e[-2] == '[' && e[-1] == ']') ? TypeName(s, e - 2)
+                 : (s != e && AllIdent(s, e)) ? kSpecNoError : kSpecUnknownType;
+        }
+
+        constexpr const char* AfterSep(const char* s, const char* e)
+        { return Find(s, e, ':') == e ? s : Find(s, e, ':') + 1; }
+
+        constexpr tArgSpecError Type(const char* s, const char* e)
+        {
+            return (s != e && s[0] == '%') ? ((e - s == 2 && IsFormat(s[1])) ? kSpecNoError : kSpecUnknownType)
+                 : (e - s >= 2 && s[0] == '<' && e[-1] == '>') ? TypeName(AfterSep(s + 1, e - 1), e - 1)
+                 : TypeName(AfterSep(s, e), e);
+        }
+
+        constexpr tArgSpecError Args(const char* s, int level, bool haveArg);
+
+        constexpr tArgSpecError ArgThen(tArgSpecError err, const char* next, int level)
+        { return err != kSpecNoError ? err : Args(next, level, true); }
+
+        constexpr tArgSpecError Arg(const char* s, const char* e, const char* next, int level, bool haveArg)
+        {
+            return (e != s && e[-1] == ']') ? Arg(s, e - 1, next, level - 1, haveArg)
+                 : IsEllipsis(s, e) ? ((haveArg && *SkipSpace(next) == 0) ? Args(next, level, haveArg) : kSpecEllipsisError)
+                 : (e != s && e[-1] == '^') ? ArgThen(Type(s, e - 1), next, level)
+                 : ArgThen(Type(s, e), next, level);
+        }
+
+        constexpr tArgSpecError Token(const char* s, const char* e, int level, bool haveArg)
+        { return s[0] == '[' ? Arg(s + 1, e, e, level + 1, haveArg) : Arg(s, e, e, level, haveArg); }
+
+        constexpr tArgSpecError Args(const char* s, int level, bool haveArg)
+        {
+            return IsSpace(*s) ? Args(s + 1, level, haveArg)
+                 : *s == 0     ? (level == 0 ? kSpecNoError : kSpecUnbalancedBrackets)
+                 : Token(s, TokenEnd(s), level, haveArg);
+        }
+
+        constexpr bool IsOption(const char* s)
+        { return s[0] == '-' && (IsAlpha(s[1]) || s[1] == '-'); }
+
+        constexpr bool IsEnvVar(const char* s)
+        { return s[0] == '$'; }
+
+        constexpr const char* AfterEnvVar(const char* s)
+        // Skips any "$NAME" environment variable binding following an option name
+        { return IsEnvVar(SkipSpace(s)) ? TokenEnd(SkipSpace(s)) : s; }
+
+        constexpr tArgSpecError EnvVarArgs(const char* s, const char* e)
+        { return (e - s > 1 && AllIdent(s + 1, e)) ? Args(e, 0, false) : kSpecBadEnvVar; }
+
+        constexpr tArgSpecError OptionArgs(const char* s)
+        { return IsEnvVar(SkipSpace(s)) ? EnvVarArgs(SkipSpace(s), TokenEnd(SkipSpace(s))) : Args(s, 0, false); }
+    }
+
+    constexpr tArgSpecError CheckSpec(const char* spec)
+    {
+        return (spec[0] == ':' || spec[0] == '=' || spec[0] == '@') ? kSpecNoError
+             : Check::IsOption(Check::SkipSpace(spec)) ? Check::OptionArgs(Check::TokenEnd(Check::SkipSpace(spec)))
+             : Check::Args(spec, 0, false);
+    }
+
+
+    namespace Check
+    // Matching of spec types against C++ types
+    {
+        constexpr bool ItemMatches(tSpecItemType expected, tSpecItemType actual)
+        {
+            return actual == expected || actual == kItemNull || actual == kItemUnknownPtr
+                || ((expected & ~kItemVectorOf) == kItemEnumPtr && actual == ((expected & kItemVectorOf) | kItemIntPtr))
+                || (expected >= kItemFloat2Ptr && expected <= kItemFloat4Ptr && actual == kItemFloatPtr);   // e.g., &v.x
+        }
+
+        constexpr bool NameIs(const char* s, const char* e, const char* name)
+        { return s == e ? *name == 0 : (*name != 0 && (*s | 0x20) == *name && NameIs(s + 1, e, name + 1)); }
+
+        constexpr tSpecItemType NamedType(const char* s, const char* e)
+        {
+            return NameIs(s, e, "bool")   ? kItemBoolPtr
+                 : NameIs(s, e, "int")    ? kItemIntPtr
+                 : NameIs(s, e, "float")  ? kItemFloatPtr
+                 : NameIs(s, e, "double") ? kItemDoublePtr
+                 : NameIs(s, e, "string") ? kItemStringPtr
+                 : (NameIs(s, e, "cstr") || NameIs(s, e, "cstring")) ? kItemCStringPtr
+                 : (NameIs(s, e, "v2") || NameIs(s, e, "vec2") || NameIs(s, e, "vector2")) ? kItemFloat2Ptr
+                 : (NameIs(s, e, "v3") || NameIs(s, e, "vec3") || NameIs(s, e, "vector3")) ? kItemFloat3Ptr
+                 : (NameIs(s, e, "v4") || NameIs(s, e, "vec4") || NameIs(s, e, "vector4")) ? kItemFloat4Ptr
+                 : kItemEnumPtr;
+        }
+
+        constexpr tSpecItemType FormatType(char c)
+        {
+            return (c == 'f' || c == 'g') ? kItemFloatPtr
+                 : (c == 'F' || c == 'G') ? kItemDoublePtr
+                 : c == 'd' ? kItemIntPtr
+                 : c == 'b' ? kItemBoolPtr
+                 : c == 's' ? kItemCStringPtr
+                 : kItemOther;
+        }
+
+        constexpr tSpecItemType ArrayType(const char* s, const char* e)
+        {
+            return (e - s > 2 && e[-2] == '[' && e[-1] == ']') ? tSpecItemType(NamedType(s, e - 2) | kItemVectorOf) : NamedType(s, e);
+        }
+
+        constexpr tSpecItemType ArgType(const char* s, const char* e)
+        {
+            return s[0] == '%' ? FormatType(s[1])
+                 : (e - s >= 2 && s[0] == '<' && e[-1] == '>') ? ArrayType(AfterSep(s + 1, e - 1), e - 1)
+                 : ArrayType(AfterSep(s, e), e);
+        }
+
+        constexpr const char* StripOpen(const char* s)
+        { return *s == '[' ? StripOpen(s + 1) : s; }
+
+        constexpr const char* StripClose(const char* s, const char* e)
+        { return (e != s && e[-1] == ']') ? StripClose(s, e - 1) : e; }
+
+        constexpr bool IsEllipsisToken(const char* s)
+        { return IsEllipsis(s, StripClose(s, TokenEnd(s))); }
+
+        constexpr tSpecItemType ListType(tSpecItemType type, const char* next)
+        { return IsEllipsisToken(SkipSpace(next)) ? tSpecItemType(type | kItemVectorOf) : type; }
+
+        constexpr tArgSpecError Types(const char* s, const tSpecItemType* t);
+
+        constexpr tArgSpecError TypesThen(bool ok, const char* next, const tSpecItemType* t)
+        { return ok ? Types(next, t) : kSpecTypeMismatch; }
+
+        constexpr tArgSpecError TypeArg(const char* s, const char* e, const char* next, const tSpecItemType* t)
+        {
+            return IsEllipsis(s, e) ? Types(next, t)
+                 : (e != s && e[-1] == '^') ? TypesThen(ItemMatches(ListType(ArgType(s, e - 1), next), t[0]) && t[1] == kItemValue, next, t + 2)
+                 : TypesThen(ItemMatches(ListType(ArgType(s, e), next), t[0]), next, t + 1);
+        }
+
+        constexpr tArgSpecError Types(const char* s, const tSpecItemType* t)
+        {
+            return IsSpace(*s) ? Types(s + 1, t)
+                 : *s == 0     ? (*t == kItemEnd ? kSpecNoError : kSpecTypeMismatch)
+                 : TypeArg(StripOpen(s), StripClose(StripOpen(s), TokenEnd(s)), TokenEnd(s), t);
+        }
+
+        constexpr tArgSpecError OptionTypes(const char* e, const tSpecItemType* t)
+        { return e[-1] == '^' ? (t[0] == kItemValue ? Types(AfterEnvVar(e), t + 1) : kSpecTypeMismatch) : Types(AfterEnvVar(e), t); }
+    }
+
+    constexpr tArgSpecError CheckSpecTypes(const char* spec, const tSpecItemType types[])
+    {
+        return CheckSpec(spec) != kSpecNoError ? CheckSpec(spec)
+             : spec[0] == ':' ? ((types[0] == kItemEnumInfo && types[1] == kItemEnd) ? kSpecNoError : kSpecTypeMismatch)
+             : spec[0] == '@' ? ((types[0] == kItemString && types[1] == kItemEnd) ? kSpecNoError : kSpecTypeMismatch)
+             : spec[0] == '=' ? kSpecNoError
+             : Check::IsOption(Check::SkipSpace(spec)) ? Check::OptionTypes(Check::TokenEnd(Check::SkipSpace(spec)), types)
+             : Check::Types(spec, types);
+    }
+
+    namespace Typed
+    // Classification of ConstructSpec() arguments by C++ type
+    {
+        template<class T, class... A> struct cBraceConstructible
+        // Whether T{ a... } compiles, which, as narrowing is an error, fails for non-float members
+        {
+            template<class U> static std::true_type  Test(decltype(U{ std::declval<A>()... })*);
+            template<class U> static std::false_type Test(...);
+
+            static constexpr bool kValue = decltype(Test<T>(nullptr))::value;
+        };
+
+        template<class T> struct cFloatsType
+        // A struct of exactly 2-4 floats, or one opted in via IsFloatVector
+        {
+            static constexpr bool kIsClass = std::is_class<T>::value && std::is_standard_layout<T>::value;
+
+            static constexpr tSpecItemType kType =
+                !kIsClass ? kItemOther
+              : sizeof(T) == 2 * sizeof(float) && (IsFloatVector<T>::value || cBraceConstructible<T, float, float>::kValue) ? kItemFloat2Ptr
+              : sizeof(T) == 3 * sizeof(float) && (IsFloatVector<T>::value || cBraceConstructible<T, float, float, float>::kValue) ? kItemFloat3Ptr
+              : sizeof(T) == 4 * sizeof(float) && (IsFloatVector<T>::value || cBraceConstructible<T, float, float, float, float>::kValue) ? kItemFloat4Ptr
+              : kItemOther;
+        };
+
+        template<class T> struct cVariableType
+        /// Type of a pointer to T
+        {
+            static constexpr tSpecItemType kType =
+                std::is_same<T, bool>::value        ? kItemBoolPtr
+              : std::is_same<T, int>::value         ? kItemIntPtr
+              : std::is_enum<T>::value              ? (sizeof(T) == sizeof(int) ? kItemEnumPtr : kItemOther)
+              : std::is_same<T, float>::value       ? kItemFloatPtr
+              : std::is_same<T, double>::value      ? kItemDoublePtr
+              : std::is_same<T, const char*>::value ? kItemCStringPtr
+              : std::is_same<T, string>::value      ? kItemStringPtr
+              : std::is_void<T>::value              ? kItemUnknownPtr
+              : cFloatsType<T>::kType;
+        };
+
+        template<size_t N> struct cVariableType<float[N]>
+        {
+            static constexpr tSpecItemType kType = N == 2 ? kItemFloat2Ptr : N == 3 ? kItemFloat3Ptr : N == 4 ? kItemFloat4Ptr : kItemOther;
+        };
+
+        template<class T> struct cVariableType<vector<T>>
+        {
+            static constexpr tSpecItemType kType =
+                (cVariableType<T>::kType & kItemVectorOf) || cVariableType<T>::kType >= kItemUnknownPtr ? kItemOther
+              : tSpecItemType(cVariableType<T>::kType | kItemVectorOf);
+        };
+
+        template<class T> struct cItemType
+        /// Type of a ConstructSpec() argument of type T
+        {
+            static constexpr tSpecItemType kType =
+                std::is_same<T, std::nullptr_t>::value ? kItemNull
+              : (std::is_integral<T>::value || std::is_enum<T>::value) ? kItemValue
+              : kItemOther;
+        };
+
+        template<class T> struct cItemType<T*>
+        {
+            typedef typename std::remove_cv<T>::type tBase;
+
+            static constexpr tSpecItemType kType =
+                std::is_same<tBase, char>::value         ? kItemString
+              : std::is_same<tBase, cArgEnumInfo>::value ? kItemEnumInfo
+              : std::is_const<T>::value                  ? (std::is_void<T>::value ? kItemUnknownPtr : kItemOther)
+              : cVariableType<T>::kType;
+        };
+
+        template<class T> struct cItemType<T* const> : cItemType<T*> {};
+
+        template<class T, size_t N> struct cItemType<T[N]>
+        {
+            static constexpr tSpecItemType kType =
+                (std::is_same<T, float>::value && N >= 2 && N <= 4) ? cVariableType<float[N]>::kType : cItemType<T*>::kType;
+        };
+
+        template<class T, size_t N> struct cItemType<const T[N]> : cItemType<const T*> {};
+
+        template<class... T> struct cItemTypes
+        {
+            static constexpr tSpecItemType kTypes[] = { cItemType<T>::kType..., kItemEnd };
+        };
+
+        template<class... T> constexpr tSpecItemType cItemTypes<T...>::kTypes[];
+
+        template<class... T> cItemTypes<T...> ItemTypes(const T&...);
+        ///< For use in decltype() only
+
+        template<class T> inline cSpecItem Item(const T& value, std::true_type)
+        { return cSpecItem(kItemValue, int(value), nullptr); }
+
+        template<class T> inline cSpecItem Item(const T& pointer, std::false_type)
+        { return cSpecItem(cItemType<T>::kType, 0, (const void*) pointer); }
+
+        template<class T> inline cSpecItem Item(const T& arg)
+        {
+            static_assert(cItemType<T>::kType != kItemOther,
+                "ConstructSpec() arguments must be strings, flags, enum tables, or pointers to supported variable types");
+
+            return Item(arg, std::integral_constant<bool, cItemType<T>::kType == kItemValue>());
+        }
+    }
+
+    template<class... T_ARGS> inline tArgSpecError cArgSpec::ConstructSpec(const char* briefDescription, const T_ARGS&... args)
+    {
+        const cSpecItem items[] = { Typed::Item(args)..., cSpecItem() };
+        return ConstructSpecItems(briefDescription, items, int(sizeof...(T_ARGS)));
+    }
+
+    template<class... T_ARGS> inline tArgSpecError cArgSpec::AppendSpec(const char* spec, const T_ARGS&... args)
+    {
+        const cSpecItem items[] = { Typed::Item(spec), Typed::Item(args)..., cSpecItem() };
+        return AppendSpecItems(items, int(1 + sizeof...(T_ARGS)));
+    }
 }
 
 #endif
@@ -0,0 +1,1524 @@
+//
+//    File:       ArgSpecBench.cpp
+//
+//    Function:   Micro-benchmarks for ArgSpec
+//
+
+#include "ArgSpec.h"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+#endif
+
+using namespace AS;
+
+#ifdef _MSC_VER
+    #define BENCH_NOINLINE __declspec(noinline)
+#else
+    #define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+namespace
+{
+    std::atomic<size_t> sNumAllocs(0);
+
+    // Out of line, so the compiler doesn't pair the malloc() and free() with the new and delete
+    // expressions that reach them, and warn of a mismatch.
+    BENCH_NOINLINE void* CountedAlloc(size_t size)
+    {
+        sNumAllocs.fetch_add(1, std::memory_order_relaxed);
+
+        if (void* p = malloc(size ? size : 1))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    BENCH_NOINLINE void CountedFree(void* p)
+    {
+        free(p);
+    }
+}
+
+void* operator new(size_t size)                     { return CountedAlloc(size); }
+void* operator new[](size_t size)                   { return CountedAlloc(size); }
+void  operator delete(void* p) noexcept             { CountedFree(p); }
+void  operator delete[](void* p) noexcept           { CountedFree(p); }
+void  operator delete(void* p, size_t) noexcept     { CountedFree(p); }
+void  operator delete[](void* p, size_t) noexcept   { CountedFree(p); }
+
+namespace
+{
+    typedef std::chrono::steady_clock tClock;
+
+    // Hardware counters
+    enum tCounter
+    {
+        kCycles,
+        kInstructions,
+        kCacheMisses,
+        kBranchMisses,
+        kMaxCounters
+    };
+
+    const char* const kCounterNames[kMaxCounters] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+    class cPerfCounters
+    // Process-wide hardware counters via perf_event_open(). Counters that can't be opened, e.g.,
+    // due to perf_event_paranoid, or in a VM, are reported as unavailable rather than failing.
+    {
+    public:
+        cPerfCounters();
+        ~cPerfCounters();
+
+        bool Available(int i) const { return mFDs[i] >= 0; }
+
+        void Start();
+        void Stop(uint64_t counts[kMaxCounters]);
+
+    protected:
+        int mFDs[kMaxCounters];
+    };
+
+#ifdef __linux__
+    cPerfCounters::cPerfCounters()
+    {
+        const uint64_t kConfigs[kMaxCounters] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        for (int i = 0; i < kMaxCounters; i++)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+
+            attr.type           = PERF_TYPE_HARDWARE;
+            attr.size           = sizeof(attr);
+            attr.config         = kConfigs[i];
+            attr.disabled       = 1;
+            attr.inherit        = 1;    // include threads started by the benchmark
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+
+            mFDs[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    cPerfCounters::~cPerfCounters()
+    {
+        for (int fd : mFDs)
+            if (fd >= 0)
+                close(fd);
+    }
+
+    void cPerfCounters::Start()
+    {
+        for (int fd : mFDs)
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+    }
+
+    void cPerfCounters::Stop(uint64_t counts[kMaxCounters])
+    {
+        for (int i = 0; i < kMaxCounters; i++)
+        {
+            counts[i] = 0;
+
+            if (mFDs[i] >= 0)
+            {
+                ioctl(mFDs[i], PERF_EVENT_IOC_DISABLE, 0);
+
+                if (read(mFDs[i], counts + i, sizeof(counts[i])) != sizeof(counts[i]))
+                    counts[i] = 0;
+            }
+        }
+    }
+#else
+    cPerfCounters::cPerfCounters()
+    {
+        for (int& fd : mFDs)
+            fd = -1;
+    }
+
+    cPerfCounters::~cPerfCounters() {}
+    void cPerfCounters::Start() {}
+
+    void cPerfCounters::Stop(uint64_t counts[kMaxCounters])
+    {
+        for (int i = 0; i < kMaxCounters; i++)
+            counts[i] = 0;
+    }
+#endif
+
+    cPerfCounters* sCounters = nullptr;
+
+
+    // Measurement
+    struct cMeasurement
+    {
+        double mNS      = 0.0;      ///< ns per op
+        double mAllocs  = 0.0;      ///< allocations per op
+        double mBytes   = 0.0;      ///< bytes processed per op, if throughput is relevant
+        double mCounters[kMaxCounters] = {};    ///< hardware counts per op
+    };
+
+    template<class T_FUNC> cMeasurement Measure(int numOps, T_FUNC func, int numRuns = 5)
+    // Returns per-op costs for 'func', which performs numOps ops. Reports the best of numRuns runs
+    // to reduce noise, along with the allocation and hardware counts of that run.
+    {
+        cMeasurement result;
+        result.mNS = 1e30;
+
+        for (int run = 0; run < numRuns; run++)
+        {
+            uint64_t counts[kMaxCounters];
+            size_t allocsBefore = sNumAllocs;
+
+            sCounters->Start();
+            tClock::time_point start = tClock::now();
+
+            func();
+
+            double ns = std::chrono::duration<double, std::nano>(tClock::now() - start).count();
+            sCounters->Stop(counts);
+
+            if (result.mNS > ns)
+            {
+                result.mNS = ns;
+                result.mAllocs = double(sNumAllocs - allocsBefore);
+
+                for (int i = 0; i < kMaxCounters; i++)
+                    result.mCounters[i] = double(counts[i]);
+            }
+        }
+
+        result.mNS /= numOps;
+        result.mAllocs /= numOps;
+
+        for (double& count : result.mCounters)
+            count /= numOps;
+
+        return result;
+    }
+
+
+    // Reporting
+    enum tFormat
+    {
+        kFormatText,
+        kFormatCSV,
+        kFormatJSON
+    };
+
+    int sFormat = kFormatText;
+
+    void ReportHeader()
+    {
+        switch (sFormat)
+        {
+        case kFormatText:
+            printf("%-24s %8s %10s %8s", "benchmark", "param", "ns/op", "allocs");
+            for (int i = 0; i < kMaxCounters; i++)
+                printf(" %13s", kCounterNames[i]);
+            printf(" %8s\n", "GB/s");
+            break;
+
+        case kFormatCSV:
+            printf("benchmark,param,ns_per_op,allocs_per_op");
+            for (int i = 0; i < kMaxCounters; i++)
+                printf(",%s_per_op", kCounterNames[i]);
+            printf(",gb_per_s\n");
+            break;
+
+        case kFormatJSON:   // JSON Lines, so there's no header
+            break;
+        }
+    }
+
+    void Report(const char* name, int param, const cMeasurement& m)
+    {
+        switch (sFormat)
+        {
+        case kFormatText:
+            printf("%-24s %8d %10.1f %8.4g", name, param, m.mNS, m.mAllocs);
+
+            for (int i = 0; i < kMaxCounters; i++)
+                if (sCounters->Available(i))
+                    printf(" %13.1f", m.mCounters[i]);
+                else
+                    printf(" %13s", "-");
+
+            if (m.mBytes > 0.0)
+                printf(" %8.2f\n", m.mBytes / m.mNS);
+            else
+                printf(" %8s\n", "-");
+            break;
+
+        case kFormatCSV:
+            printf("%s,%d,%.2f,%.4g", name, param, m.mNS, m.mAllocs);
+
+            for (int i = 0; i < kMaxCounters; i++)
+                if (sCounters->Available(i))
+                    printf(",%.2f", m.mCounters[i]);
+                else
+                    printf(",");
+
+            if (m.mBytes > 0.0)
+                printf(",%.3f\n", m.mBytes / m.mNS);
+            else
+                printf(",\n");
+            break;
+
+        case kFormatJSON:
+            printf("{\"benchmark\": \"%s\", \"param\": %d, \"ns_per_op\": %.2f, \"allocs_per_op\": %.4g", name, param, m.mNS, m.mAllocs);
+
+            for (int i = 0; i < kMaxCounters; i++)
+                if (sCounters->Available(i))
+                    printf(", \"%s_per_op\": %.2f", kCounterNames[i], m.mCounters[i]);
+                else
+                    printf(", \"%s_per_op\": null", kCounterNames[i]);
+
+            if (m.mBytes > 0.0)
+                printf(", \"gb_per_s\": %.3f}\n", m.mBytes / m.mNS);
+            else
+                printf(", \"gb_per_s\": null}\n");
+            break;
+        }
+
+        fflush(stdout);
+    }
+
+    void ReportThroughput(const char* name, int param, double bytesPerOp, cMeasurement m)
+    {
+        m.mBytes = bytesPerOp;
+        Report(name, param, m);
+    }
+
+    uint32_t sSeed = 12345;
+
+    uint32_t Random()
+    {
+        sSeed = sSeed * 1664525 + 1013904223;
+        return sSeed >> 8;
+    }
+
+    void AddOptions(cArgSpec* spec, int numOptions, int* location, vector<string>* names)
+    // Add numOptions options of the form "-optN <int>", all bound to 'location'.
+    {
+        char buffer[64];
+
+        for (int i = 0; i < numOptions; i++)
+        {
+            snprintf(buffer, sizeof(buffer), "-opt%d", i);
+            names->push_back(buffer);
+
+            snprintf(buffer, sizeof(buffer), "-opt%d <int>", i);
+            spec->AppendSpec(buffer, location, "Benchmark option", nullptr);
+        }
+    }
+
+
+    // Previous strtol/strtof-based number parsing, for comparison
+    tArgError LegacyParse(int* location, const char* arg)
+    {
+        char* sEnd;
+        *location = (int) strtol(arg, &sEnd, 0);
+        return sEnd[0] == 0 ? kArgNoError : kArgErrorGarbage;
+    }
+
+    tArgError LegacyParse(float* location, const char* arg)
+    {
+        char* sEnd;
+        *location = strtof(arg, &sEnd);
+        return sEnd[0] == 0 ? kArgNoError : kArgErrorGarbage;
+    }
+
+    tArgError LegacyParse(double* location, const char* arg)
+    {
+        char* sEnd;
+        *location = strtod(arg, &sEnd);
+        return sEnd[0] == 0 ? kArgNoError : kArgErrorGarbage;
+    }
+
+    tArgError LegacyParse(bool* location, const char* arg)
+    {
+        if (strcasecmp(arg, "true") == 0 || strcasecmp(arg, "on") == 0)
+            *location = true;
+        else if (strcasecmp(arg, "false") == 0 || strcasecmp(arg, "off") == 0)
+            *location = false;
+        else
+        {
+            int i;
+            tArgError error = LegacyParse(&i, arg);
+            *location = i != 0;
+            return error;
+        }
+
+        return kArgNoError;
+    }
+
+    // Previous linear enum lookup, for comparison
+    tArgError LegacyParse(int* location, const cArgEnumInfo* enumInfo, const char* arg)
+    {
+        for ( ; enumInfo->mToken; enumInfo++)
+            if (strcasecmp(arg, enumInfo->mToken) == 0)
+            {
+                *location = enumInfo->mValue;
+                return kArgNoError;
+            }
+
+        return kArgErrorBadEnum;
+    }
+
+    void LegacySplit(const char* line, vector<const char*>* a, vector<char>* scratch, const char* separators)
+    {
+        size_t len = strlen(line);
+
+        scratch->assign(line, line + len + 1);
+        a->clear();
+
+        char* s = scratch->data();
+
+        while (true)
+        {
+            s += strspn(s, separators);
+
+            if (!*s)
+                break;
+
+            a->push_back(s);
+            s += strcspn(s, separators);
+
+            if (!*s)
+                break;
+
+            *s++ = 0;
+        }
+    }
+
+
+    // Benchmarks
+    void BenchParse()
+    // Whole Parse() calls, by spec size and argv length, from typical short command lines to long generated ones.
+    {
+        const int kArgCounts[] = { 16, 1024 };
+
+        for (int numOptions = 10; numOptions <= 1000; numOptions *= 10)
+        {
+            int value = 0;
+            vector<string> names;
+
+            cArgSpec spec;
+            spec.ConstructSpec("Parse benchmark", nullptr);
+            AddOptions(&spec, numOptions, &value, &names);
+
+            for (int argCount : kArgCounts)
+            {
+                vector<string> values;
+                vector<const char*> argv(1, "bench");
+
+                for (int i = 0; i < argCount / 2; i++)
+                    values.push_back(std::to_string(Random() % 10000));
+
+                for (int i = 0; i < argCount / 2; i++)
+                {
+                    argv.push_back(names[Random() % numOptions].c_str());
+                    argv.push_back(values[i].c_str());
+                }
+
+                const int kReps = 100000 / argCount;
+
+                cMeasurement result = Measure(kReps,
+                    [&]
+                    {
+                        for (int i = 0; i < kReps; i++)
+                            spec.Parse(int(argv.size()), argv.data());
+                    }
+                );
+
+                char name[32];
+                snprintf(name, sizeof(name), "parse_argc%d", argCount);
+                Report(name, numOptions, result);
+            }
+        }
+    }
+
+    void BenchOptionLookup()
+    {
+        const int kNumTokens = 1000;
+
+        for (int numOptions = 10; numOptions <= 10000; numOptions *= 10)
+        {
+            int value = 0;
+            vector<string> names;
+
+            cArgSpec spec;
+            spec.ConstructSpec("Option lookup benchmark", nullptr);
+            AddOptions(&spec, numOptions, &value, &names);
+
+            vector<const char*> argv(1, "bench");
+
+            for (int i = 0; i < kNumTokens; i++)
+            {
+                argv.push_back(names[Random() % numOptions].c_str());
+                argv.push_back("1");
+            }
+
+            const int kReps = 100;
+
+            cMeasurement result = Measure(kReps * kNumTokens,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        spec.Parse(int(argv.size()), argv.data());
+                }
+            );
+
+            Report("option_lookup", numOptions, result);
+
+            // Same again via abbreviations, e.g., -opt12_v for -opt12_value
+            cArgSpec prefixSpec;
+            prefixSpec.ConstructSpec("Option prefix benchmark", nullptr);
+
+            vector<string> prefixes;
+            char buffer[64];
+
+            for (int i = 0; i < numOptions; i++)
+            {
+                snprintf(buffer, sizeof(buffer), "-opt%d_value <int>", i);
+                prefixSpec.AppendSpec(buffer, &value, "Benchmark option", nullptr);
+
+                snprintf(buffer, sizeof(buffer), "-opt%d_v", i);
+                prefixes.push_back(buffer);
+            }
+
+            for (size_t i = 1; i < argv.size(); i += 2)
+                argv[i] = prefixes[Random() % numOptions].c_str();
+
+            result = Measure(kReps * kNumTokens,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        prefixSpec.Parse(int(argv.size()), argv.data());
+                }
+            );
+
+            Report("option_prefix", numOptions, result);
+        }
+    }
+
+    void BenchEnumLookup()
+    {
+        const int kNumTokens = 1000;
+
+        for (int numValues = 10; numValues <= 100000; numValues *= 10)
+        {
+            vector<string> names;
+            vector<cArgEnumInfo> enumInfo;
+
+            for (int i = 0; i < numValues; i++)
+                names.push_back("variant_" + std::to_string(i));
+            for (int i = 0; i < numValues; i++)
+                enumInfo.push_back( { names[i].c_str(), i } );
+
+            enumInfo.push_back( { nullptr, 0 } );
+
+            vector<int> values;
+            cArgSpec spec;
+            spec.ConstructSpec
+            (
+                "Enum lookup benchmark",
+                ":variant", enumInfo.data(),
+                "-variants <variant> ...", &values, "Variants",
+                nullptr
+            );
+
+            vector<const char*> argv = { "bench", "-variants" };
+
+            for (int i = 0; i < kNumTokens; i++)
+                argv.push_back(names[Random() % numValues].c_str());
+
+            const int kReps = numValues <= 1000 ? 100 : 1;
+            volatile int sink;
+
+            cMeasurement result = Measure(kReps * kNumTokens,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        for (int j = 2; j < int(argv.size()); j++)
+                        {
+                            int value = 0;
+                            LegacyParse(&value, enumInfo.data(), argv[j]);
+                            sink = value;
+                        }
+                }
+            );
+
+            Report("enum_lookup_legacy", numValues, result);
+
+            result = Measure(kReps * kNumTokens,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        spec.Parse(int(argv.size()), argv.data());
+                }
+            );
+
+            Report("enum_lookup", numValues, result);
+            (void) sink;
+        }
+    }
+
+    void BenchFlagDispatch()
+    // Visit the flags set by a parse, either by querying each one, or by scanning the flag words.
+    {
+        const int kNumFlags = 512;
+        const int kNumSet = 32;
+        const int kReps = 10000;
+
+        cArgSpec spec;
+        spec.ConstructSpec("Flag dispatch benchmark", nullptr);
+
+        vector<string> names;
+        char buffer[64];
+
+        for (int i = 0; i < kNumFlags; i++)
+        {
+            snprintf(buffer, sizeof(buffer), "-flag%d", i);
+            names.push_back(buffer);
+
+            snprintf(buffer, sizeof(buffer), "-flag%d^", i);
+            spec.AppendSpec(buffer, i, "Benchmark flag", nullptr);
+        }
+
+        vector<const char*> argv(1, "bench");
+
+        for (int i = 0; i < kNumSet; i++)
+            argv.push_back(names[Random() % kNumFlags].c_str());
+
+        spec.Parse(int(argv.size()), argv.data());
+
+        volatile int sink;
+
+        cMeasurement result = Measure(kReps,
+            [&]
+            {
+                for (int i = 0; i < kReps; i++)
+                {
+                    int sum = 0;
+
+                    for (int flag = 0; flag < kNumFlags; flag++)
+                        if (spec.Flag(flag))
+                            sum += flag;
+
+                    sink = sum;
+                }
+            }
+        );
+
+        Report("flag_query", kNumFlags, result);
+
+        result = Measure(kReps,
+            [&]
+            {
+                for (int i = 0; i < kReps; i++)
+                {
+                    int sum = 0;
+                    int numWords;
+                    const uint64_t* words = spec.FlagWords(&numWords);
+
+                    for (int w = 0; w < numWords; w++)
+                        for (uint64_t bits = words[w]; bits; bits &= bits - 1)
+                            sum += 64 * w + CountTrailingZeros(bits);     // from ArgSpec.h's implementation
+
+                    sink = sum;
+                }
+            }
+        );
+
+        Report("flag_words", kNumFlags, result);
+        (void) sink;
+    }
+
+    void BenchHelp()
+    {
+        for (int numOptions = 10; numOptions <= 1000; numOptions *= 10)
+        {
+            int value = 0;
+            vector<string> names;
+
+            cArgSpec spec;
+            spec.ConstructSpec("Help benchmark", nullptr);
+            AddOptions(&spec, numOptions, &value, &names);
+
+            const int kReps = 10000 / numOptions;
+            string help;
+
+            const char* const kTypeNames[kNumArgHelpTypes] = { "help_brief", "help_full", "help_html", "help_markdown" };
+
+            for (int type = 0; type < kNumArgHelpTypes; type++)
+            {
+                cMeasurement result = Measure(kReps,
+                    [&]
+                    {
+                        for (int i = 0; i < kReps; i++)
+                        {
+                            help.clear();
+                            spec.CreateHelpString("bench", &help, tHelpType(type));
+                        }
+                    }
+                );
+
+                Report(kTypeNames[type], numOptions, result);
+            }
+
+            size_t bytes = 0;
+            auto countBytes = [](void* userData, const char*, size_t size) { *static_cast<size_t*>(userData) += size; };
+
+            cMeasurement result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        spec.WriteHelp("bench", kHelpHTML, countBytes, &bytes);
+                }
+            );
+
+            Report("help_stream", numOptions, result);
+
+            volatile size_t sink;
+
+            result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        sink = size_t(spec.HelpString("bench", kHelpHTML)[0]);
+                }
+            );
+
+            Report("help_cached", numOptions, result);
+            (void) sink;
+        }
+    }
+
+    template<class T> void BenchNumbers(const char* name, const vector<string>& values)
+    {
+        const int kReps = 100;
+        const int numOps = kReps * int(values.size());
+        T parsed = T();
+        volatile T sink;    // keep the optimizer honest
+
+        cMeasurement result = Measure(numOps,
+            [&]
+            {
+                for (int i = 0; i < kReps; i++)
+                    for (const string& value : values)
+                    {
+                        LegacyParse(&parsed, value.c_str());
+                        sink = parsed;
+                    }
+            }
+        );
+
+        string legacyName = string(name) + "_legacy";
+        Report(legacyName.c_str(), int(values.size()), result);
+
+        result = Measure(numOps,
+            [&]
+            {
+                for (int i = 0; i < kReps; i++)
+                    for (const string& value : values)
+                    {
+                        AS::Parse(&parsed, value.c_str());     // the library's internal number kernel
+                        sink = parsed;
+                    }
+            }
+        );
+
+        Report(name, int(values.size()), result);
+    }
+
+    void BenchNumberParsing()
+    {
+        const int kNumValues = 10000;
+        vector<string> ints, floats, bools;
+        char buffer[64];
+
+        const char* kBoolTokens[] = { "true", "false", "on", "off", "1", "0" };
+
+        for (int i = 0; i < kNumValues; i++)
+        {
+            snprintf(buffer, sizeof(buffer), (i & 7) ? "%d" : "0x%x", int(Random()) - (1 << 23));
+            ints.push_back(buffer);
+
+            snprintf(buffer, sizeof(buffer), "%.*g", 3 + i % 6, (Random() - 8e6) / 1024.0);
+            floats.push_back(buffer);
+
+            bools.push_back(kBoolTokens[Random() % 6]);
+        }
+
+        BenchNumbers<int>   ("parse_int",    ints);
+        BenchNumbers<float> ("parse_float",  floats);
+        BenchNumbers<double>("parse_double", floats);
+        BenchNumbers<bool>  ("parse_bool",   bools);
+    }
+
+    void BenchSplitArray()
+    {
+        const int kNumValues = 1000000;
+        string ints, floats;
+
+        for (int i = 0; i < kNumValues; i++)
+        {
+            ints += std::to_string(Random() % 100000);
+            ints += (i % 16 == 15) ? ",  " : " ";
+
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.4f ", (Random() % 100000) / 16.0);
+            floats += buffer;
+        }
+
+        cSeparators separators;
+        separators.Set(" \t,");
+        size_t numTokens = 0;
+
+        cMeasurement result = Measure(kNumValues,
+            [&]
+            {
+                cSplitScanner scanner(ints.data(), ints.data() + ints.size(), separators);
+                const char* token;
+                const char* tokenEnd;
+
+                numTokens = 0;
+                while (scanner.Next(&token, &tokenEnd))
+                    numTokens++;
+            }
+        );
+
+        AS_ASSERT(numTokens == kNumValues);
+        ReportThroughput("split_scan", kNumValues, double(ints.size()) / kNumValues, result);
+
+        vector<const char*> tokens;
+        vector<char> scratch;
+        vector<int> values;
+
+        result = Measure(kNumValues,
+            [&]
+            {
+                LegacySplit(ints.c_str(), &tokens, &scratch, " \t,");
+                values.clear();
+
+                for (const char* token : tokens)
+                    values.push_back(int(strtol(token, nullptr, 0)));
+            }
+        );
+
+        ReportThroughput("split_int_legacy", kNumValues, double(ints.size()) / kNumValues, result);
+
+        vector<int> counts;
+        vector<float> scales;
+        cArgSpec spec;
+
+        spec.ConstructSpec
+        (
+            "Split array benchmark",
+            "-counts <int[]>", &counts, "Counts",
+            "-scales <float[]>", &scales, "Scales",
+            nullptr
+        );
+        spec.SetArraySeparators(" \t,");
+
+        const char* intArgv[] = { "bench", "-counts", ints.c_str() };
+        result = Measure(kNumValues, [&] { spec.Parse(3, intArgv); });
+        ReportThroughput("split_int", kNumValues, double(ints.size()) / kNumValues, result);
+
+        const char* floatArgv[] = { "bench", "-scales", floats.c_str() };
+        result = Measure(kNumValues, [&] { spec.Parse(3, floatArgv); });
+        ReportThroughput("split_float", kNumValues, double(floats.size()) / kNumValues, result);
+    }
+
+    void BenchSpecLoad()
+    {
+        for (int numOptions = 10; numOptions <= 1000; numOptions *= 10)
+        {
+            int value = 0;
+            vector<string> names;
+
+            const int kReps = 100;
+
+            cMeasurement result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                    {
+                        cArgSpec spec;
+                        spec.ConstructSpec("Spec load benchmark", nullptr);
+                        names.clear();
+                        AddOptions(&spec, numOptions, &value, &names);
+                    }
+                }
+            );
+
+            Report("spec_construct", numOptions, result);
+
+            cArgSpec spec;
+            spec.ConstructSpec("Spec load benchmark", nullptr);
+            AddOptions(&spec, numOptions, &value, &names);
+
+            vector<char> data;
+            spec.SaveSpec(&data);
+
+            vector<void*> bindings(spec.NumBindings(), &value);
+
+            result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                    {
+                        cArgSpec loadedSpec;
+                        loadedSpec.LoadSpec(data.data(), data.size(), bindings.data(), int(bindings.size()));
+                    }
+                }
+            );
+
+            Report("spec_load", numOptions, result);
+
+            result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                    {
+                        cArgSpec clonedSpec;
+                        clonedSpec.Clone(spec, bindings.data(), int(bindings.size()));
+                    }
+                }
+            );
+
+            Report("spec_clone", numOptions, result);
+        }
+
+        // A single option with many arguments, to check spec tokenizing is linear in spec length
+        for (int numArgs = 10; numArgs <= 10000; numArgs *= 10)
+        {
+            int value = 0;
+            string longSpec = "-long";
+            char buffer[32];
+
+            for (int i = 0; i < numArgs; i++)
+            {
+                snprintf(buffer, sizeof(buffer), " <arg%d:int>", i);
+                longSpec += buffer;
+            }
+
+            vector<cSpecItem> items;
+            items.push_back(cSpecItem(kItemString, 0, longSpec.c_str()));
+            items.insert(items.end(), numArgs, cSpecItem(kItemIntPtr, 0, &value));
+            items.push_back(cSpecItem(kItemString, 0, "Long option"));
+
+            const int kReps = 10;
+
+            cMeasurement result = Measure(kReps * numArgs,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                    {
+                        cArgSpec spec;
+                        spec.ConstructSpecItems("Long spec benchmark", items.data(), int(items.size()));
+                    }
+                }
+            );
+
+            ReportThroughput("spec_long", numArgs, double(longSpec.size()) / numArgs, result);
+        }
+    }
+
+    tArgSpecError ConstructSubcommand(void* userData, cArgSpec* spec)
+    {
+        return spec->ConstructSpec("Subcommand", "-n <int>", static_cast<int*>(userData), "Count", nullptr);
+    }
+
+    void BenchSubcommands()
+    {
+        for (int numCommands = 10; numCommands <= 1000; numCommands *= 10)
+        {
+            int value = 0;
+            vector<string> names;
+
+            for (int i = 0; i < numCommands; i++)
+                names.push_back("cmd" + std::to_string(i));
+
+            // Registration is all a tool pays at startup, whatever the number of subcommands
+            const int kReps = 100;
+
+            cMeasurement result = Measure(kReps * numCommands,
+                [&]
+                {
+                    for (int r = 0; r < kReps; r++)
+                    {
+                        cArgSubcommands commands("Subcommand benchmark");
+
+                        for (const string& name : names)
+                            commands.Add(name.c_str(), "Subcommand", ConstructSubcommand, &value);
+                    }
+                }
+            );
+
+            Report("subcommand_add", numCommands, result);
+
+            cArgSubcommands commands("Subcommand benchmark");
+
+            for (const string& name : names)
+                commands.Add(name.c_str(), "Subcommand", ConstructSubcommand, &value);
+
+            const char* argv[] = { "bench", names.back().c_str(), "-n", "1" };
+            commands.Parse(4, argv);    // construct its spec
+
+            const int kParses = 100000;
+
+            result = Measure(kParses,
+                [&]
+                {
+                    for (int i = 0; i < kParses; i++)
+                        commands.Parse(4, argv);
+                }
+            );
+
+            Report("subcommand_parse", numCommands, result);
+        }
+    }
+
+#ifndef _WIN32
+    void BenchEnvironment()
+    {
+        const int kNumUnrelated = 1000;    // typical of a CI job's environment
+
+        for (int i = 0; i < kNumUnrelated; i++)
+            setenv(("BENCH_OTHER_" + std::to_string(i)).c_str(), "/usr/local/bin:/usr/bin:/bin", 1);
+
+        for (int numOptions = 10; numOptions <= 1000; numOptions *= 10)
+        {
+            vector<int> values(numOptions);
+            vector<string> names;
+            char buffer[64];
+
+            cArgSpec spec;
+            spec.ConstructSpec("Environment benchmark", nullptr);
+            spec.SetEnvironment(true);
+
+            for (int i = 0; i < numOptions; i++)
+            {
+                snprintf(buffer, sizeof(buffer), "-opt%d $BENCH_OPT_%d <int>", i, i);
+                spec.AppendSpec(buffer, &values[i], "Benchmark option", nullptr);
+
+                names.push_back("BENCH_OPT_" + std::to_string(i));
+
+                if (i % 2 == 0)     // half are set
+                    setenv(names.back().c_str(), std::to_string(i).c_str(), 1);
+            }
+
+            const char* argv[] = { "bench" };
+            const int kReps = 100;
+
+            cMeasurement result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        spec.Parse(1, argv);
+                }
+            );
+
+            Report("env_parse", numOptions, result);
+
+            // For comparison, what a getenv() per option costs, without any conversion
+            result = Measure(kReps,
+                [&]
+                {
+                    for (int i = 0; i < kReps; i++)
+                        for (const string& name : names)
+                            if (const char* value = getenv(name.c_str()))
+                                values[0] += value[0];
+                }
+            );
+
+            Report("env_getenv", numOptions, result);
+
+            for (const string& name : names)
+                unsetenv(name.c_str());
+        }
+
+        for (int i = 0; i < kNumUnrelated; i++)
+            unsetenv(("BENCH_OTHER_" + std::to_string(i)).c_str());
+    }
+#endif
+
+    void BenchCompletion()
+    {
+        const int kNumQueries = 10000;
+
+        for (int numNames = 100; numNames <= 100000; numNames *= 10)
+        {
+            // Both options and enum tokens share a prefix, so queries narrow them down as they would when typing
+            vector<string> options;
+            vector<string> tokens;
+            vector<cArgEnumInfo> enumInfo;
+
+            for (int i = 0; i < numNames; i++)
+            {
+                options.push_back("-opt" + std::to_string(i) + " <int>");
+                tokens.push_back("variant_" + std::to_string(i));
+            }
+
+            for (int i = 0; i < numNames; i++)
+                enumInfo.push_back( { tokens[i].c_str(), i } );
+
+            enumInfo.push_back( { nullptr, 0 } );
+
+            int value = 0;
+            cArgSpec spec;
+            spec.ConstructSpec("Completion benchmark", ":variant", enumInfo.data(), "-variant <variant>", &value, "Variant", nullptr);
+
+            for (const string& option : options)
+                spec.AppendSpec(option.c_str(), &value, "Benchmark option", nullptr);
+
+            vector<string> prefixes;
+
+            for (int i = 0; i < kNumQueries; i++)
+            {
+                string name = std::to_string(Random() % numNames);
+                prefixes.push_back(name.substr(0, name.size() - (name.size() > 1)));    // a few matches each
+            }
+
+            vector<string> completions;
+            string hint;
+            const char* argv[3] = { "bench", "-variant", nullptr };
+
+            spec.Complete(1, argv, 1, &completions);    // build the index
+
+            cMeasurement result = Measure(kNumQueries,
+                [&]
+                {
+                    for (const string& prefix : prefixes)
+                    {
+                        string word = "-opt" + prefix;
+                        argv[1] = word.c_str();
+                        spec.Complete(2, argv, 1, &completions, &hint);
+                    }
+                }
+            );
+
+            Report("complete_option", numNames, result);
+
+            result = Measure(kNumQueries,
+                [&]
+                {
+                    argv[1] = "-variant";
+
+                    for (const string& prefix : prefixes)
+                    {
+                        string word = "variant_" + prefix;
+                        argv[2] = word.c_str();
+                        spec.Complete(3, argv, 2, &completions, &hint);
+                    }
+                }
+            );
+
+            Report("complete_enum", numNames, result);
+        }
+    }
+
+    void BenchListArgs()
+    {
+        const int kNumValues = 1000000;
+
+        vector<int> counts;
+        struct cVec3 { float x, y, z; };
+        vector<cVec3> v3s;      // unused, present so the lists are separated by an option
+        cArgSpec spec;
+        spec.ConstructSpec
+        (
+            "List argument benchmark",
+            "-counts <int> ...", &counts, "Counts",
+            "-v3s <vec3> ...", &v3s, "Vectors",
+            nullptr
+        );
+
+        vector<string> values;
+        vector<const char*> argv = { "bench", "-counts" };
+
+        for (int i = 0; i < kNumValues; i++)
+            values.push_back(std::to_string(Random() % 1000));
+
+        for (const string& value : values)
+            argv.push_back(value.c_str());
+
+        argv.push_back("--");
+
+        // First parse into an empty vector, then repeated parses, which should reuse its capacity
+        cMeasurement result = Measure(kNumValues, [&] { spec.Parse(int(argv.size()), argv.data()); }, 1);
+        Report("list_first", kNumValues, result);
+
+        result = Measure(kNumValues, [&] { spec.Parse(int(argv.size()), argv.data()); });
+        Report("list_repeat", kNumValues, result);
+    }
+
+    void BenchResponseFile()
+    {
+        const int kNumTokens = 1000000;
+        const char* kPath = "/tmp/ArgSpecBench-args.txt";
+
+        vector<int> counts;
+        cArgSpec spec;
+        spec.ConstructSpec("Response file benchmark", "-counts <int> ...", &counts, "Counts", nullptr);
+
+        vector<string> tokens;
+        vector<const char*> argv = { "bench", "-counts" };
+
+        FILE* file = fopen(kPath, "w");
+        fprintf(file, "-counts");
+
+        for (int i = 0; i < kNumTokens; i++)
+        {
+            tokens.push_back(std::to_string(Random() % 1000));
+            fprintf(file, " %s", tokens.back().c_str());
+        }
+
+        fclose(file);
+
+        for (const string& token : tokens)
+            argv.push_back(token.c_str());
+
+        cMeasurement result = Measure(kNumTokens, [&] { spec.Parse(int(argv.size()), argv.data()); });
+        Report("parse_argv_tokens", kNumTokens, result);
+
+        string fileArg = string("@") + kPath;
+        const char* fileArgv[] = { "bench", fileArg.c_str() };
+
+        result = Measure(kNumTokens, [&] { spec.Parse(2, fileArgv); });
+        Report("parse_file_tokens", kNumTokens, result);
+
+        remove(kPath);
+    }
+
+    void BenchConfigFile()
+    {
+        const size_t kFileSize = 10 << 20;
+        const int kNumOptions = 1000;
+        const char* kPath = "/tmp/ArgSpecBench-config.ini";
+
+        vector<int> values(kNumOptions);
+        vector<string> names;
+        char buffer[64];
+
+        cArgSpec spec;
+        spec.ConstructSpec("Config file benchmark", nullptr);
+
+        for (int i = 0; i < kNumOptions; i++)
+        {
+            snprintf(buffer, sizeof(buffer), "-opt%d <int>", i);
+            spec.AppendSpec(buffer, &values[i], "Benchmark option", nullptr);
+            names.push_back(buffer + 1);
+            names.back().resize(names.back().find(' '));
+        }
+
+        FILE* file = fopen(kPath, "w");
+        size_t size = 0;
+        int numLines = 0;
+
+        fprintf(file, "# Config benchmark\n");
+
+        while (size < kFileSize)
+        {
+            int n = fprintf(file, "%s = %u\n", names[Random() % kNumOptions].c_str(), Random() % 100000);
+            size += size_t(n);
+            numLines++;
+        }
+
+        fclose(file);
+
+        // Reading the file alone, for comparison
+        vector<char> contents(size + 64);
+
+        cMeasurement result = Measure(numLines,
+            [&]
+            {
+                FILE* f = fopen(kPath, "rb");
+                size_t numRead = fread(contents.data(), 1, contents.size(), f);
+                fclose(f);
+                values[0] += int(numRead & 1);
+            }
+        );
+
+        ReportThroughput("config_read", numLines, double(size) / numLines, result);
+
+        spec.SetConfigFile(kPath);
+        const char* argv[] = { "bench" };
+
+        result = Measure(numLines, [&] { spec.Parse(1, argv); });
+        ReportThroughput("config_parse", numLines, double(size) / numLines, result);
+
+        remove(kPath);
+    }
+
+#ifndef _WIN32
+    void CountCommand(void* userData, const cArgSpec&, cArgParseContext*, string* reply)
+    {
+        ++*static_cast<int*>(userData);
+        reply->append("ok");
+    }
+
+    void BenchCommandStream()
+    {
+        const int kNumCommands = 1000000;
+        const char* kPath = "/tmp/ArgSpecBench-commands.txt";
+        const char* kSocketPath = "/tmp/ArgSpecBench.sock";
+
+        int size = 0;
+        double gamma = 0.0;
+        string name;
+
+        cArgSpec spec;
+        spec.ConstructSpec
+        (
+            "Command stream benchmark",
+            "-size %d", &size, "Size",
+            "-gamma %F", &gamma, "Gamma",
+            "-name <string>", &name, "Name",
+            nullptr
+        );
+
+        string commands;
+
+        for (int i = 0; i < kNumCommands; i++)
+        {
+            char buffer[64];
+            snprintf(buffer, sizeof(buffer), "-size %d -gamma 2.2 -name cmd%d\n", i, Random() % 1000);
+            commands += buffer;
+        }
+
+        FILE* file = fopen(kPath, "w");
+        fwrite(commands.data(), 1, commands.size(), file);
+        fclose(file);
+
+        int handled = 0;
+
+        cMeasurement result = Measure(kNumCommands,
+            [&]
+            {
+                int inFD = open(kPath, O_RDONLY);
+                int outFD = open("/dev/null", O_WRONLY);
+
+                cArgCommandProcessor processor(spec, CountCommand, &handled);
+                processor.AddClient(inFD, outFD);
+                processor.Run();
+
+                close(inFD);
+                close(outFD);
+            }
+        );
+
+        Report("command_file", kNumCommands, result);
+        remove(kPath);
+
+        // Same again via a Unix socket, with separate client threads writing commands and reading replies
+        result = Measure(kNumCommands,
+            [&]
+            {
+                cArgCommandProcessor processor(spec, CountCommand, &handled);
+                processor.Listen(kSocketPath);
+
+                std::thread client(
+                    [&]
+                    {
+                        sockaddr_un address = {};
+                        address.sun_family = AF_UNIX;
+                        strcpy(address.sun_path, kSocketPath);
+
+                        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                        connect(fd, (const sockaddr*) &address, sizeof(address));
+
+                        std::thread reader(
+                            [fd]
+                            {
+                                char buffer[64 * 1024];
+                                while (read(fd, buffer, sizeof(buffer)) > 0)
+                                    ;
+                            }
+                        );
+
+                        for (size_t sent = 0; sent < commands.size(); )
+                        {
+                            ssize_t result = write(fd, commands.data() + sent, commands.size() - sent);
+                            if (result <= 0)
+                                break;
+                            sent += result;
+                        }
+
+                        shutdown(fd, SHUT_WR);
+                        reader.join();
+                        close(fd);
+                    }
+                );
+
+                int numCommands = 0;
+
+                while (numCommands < kNumCommands)
+                    numCommands += processor.Poll(-1);
+
+                while (processor.NumClients() > 0)  // flush remaining replies
+                    processor.Poll(-1);
+
+                client.join();
+            }
+        );
+
+        Report("command_socket", kNumCommands, result);
+    }
+#endif
+
+    void BenchThreadScaling()
+    {
+        struct cVars
+        {
+            int         mSize = 0;
+            double      mGamma = 0.0;
+            string      mName;
+            vector<int> mCounts;
+        };
+
+        cVars protoVars;
+        cArgSpec spec;
+
+        spec.ConstructSpec
+        (
+            "Thread scaling benchmark",
+            "-size %d", &protoVars.mSize, "Size",
+            "-gamma %F", &protoVars.mGamma, "Gamma",
+            "-name <string>", &protoVars.mName, "Name",
+            "-counts <int> ...", &protoVars.mCounts, "Counts",
+            nullptr
+        );
+
+        const char* argv[] = { "bench", "-size", "100", "-gamma", "2.2", "-name", "test", "-counts", "1", "2", "3", "4" };
+        const int argc = sizeof(argv) / sizeof(argv[0]);
+
+        const int kParsesPerThread = 100000;
+
+        for (int numThreads = 1; numThreads <= 8; numThreads *= 2)
+        {
+            cMeasurement result = Measure(numThreads * kParsesPerThread,
+                [&]
+                {
+                    vector<std::thread> threads;
+
+                    for (int t = 0; t < numThreads; t++)
+                        threads.emplace_back(
+                            [&]
+                            {
+                                cVars vars;     // each thread parses into its own variables via its own context
+                                void* bindings[] = { &vars.mSize, &vars.mGamma, &vars.mName, &vars.mCounts };
+
+                                cArgParseContext context;
+                                context.Bind(bindings, spec.NumBindings());
+
+                                for (int i = 0; i < kParsesPerThread; i++)
+                                    spec.Parse(argc, argv, &context);
+                            }
+                        );
+
+                    for (std::thread& thread : threads)
+                        thread.join();
+                }
+            );
+
+            Report("parse_threads", numThreads, result);
+        }
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    struct cBenchmark
+    {
+        const char* mName;
+        void (*mFunc)();
+    };
+
+    const cBenchmark kBenchmarks[] =
+    {
+        { "numbers",  BenchNumberParsing },
+        { "split",    BenchSplitArray    },
+        { "parse",    BenchParse         },
+        { "options",  BenchOptionLookup  },
+        { "enums",    BenchEnumLookup    },
+        { "flags",    BenchFlagDispatch  },
+        { "help",     BenchHelp          },
+        { "spec",     BenchSpecLoad      },
+        { "subcmds",  BenchSubcommands   },
+        { "complete", BenchCompletion    },
+    #ifndef _WIN32
+        { "environ",  BenchEnvironment   },
+    #endif
+        { "lists",    BenchListArgs      },
+        { "response", BenchResponseFile  },
+        { "config",   BenchConfigFile    },
+    #ifndef _WIN32
+        { "commands", BenchCommandStream },
+    #endif
+        { "threads",  BenchThreadScaling },
+    };
+
+    string filter;
+    cArgSpec argSpec;
+
+    argSpec.ConstructSpec
+    (
+        "Micro-benchmarks for ArgSpec. Reports time, allocations, and, where available, hardware counters per op.",
+        "=format", "text", kFormatText, "csv", kFormatCSV, "json", kFormatJSON, nullptr,
+        "-format <format>", &sFormat,
+            "Output format. csv has a header line, json has one object per line.",
+        "-filter <string>", &filter,
+            "Run only benchmark groups whose name contains the given string:"
+            " numbers, split, parse, options, enums, flags, help, spec, subcmds, complete, environ, lists, response, config, commands, threads",
+        nullptr
+    );
+
+    if (argSpec.Parse(argc, argv) != kArgNoError)
+    {
+        printf("%s\n", argSpec.ErrorString());
+        return -1;
+    }
+
+    cPerfCounters counters;
+    sCounters = &counters;
+
+    ReportHeader();
+
+    for (const cBenchmark& benchmark : kBenchmarks)
+        if (strstr(benchmark.mName, filter.c_str()))
+            benchmark.mFunc();
+
+    return 0;
+}
@@ -102,7 +102,7 @@ struct cCommand
             "-v4 <vec4>", mV4,
                 "Set v4",
 
-            "-scale %f [%f %f^]", mScaleXYZ + 0, mScaleXYZ + 1, mScaleXYZ + 2, kOptionScaleXYZ,
+            AS_SPEC("-scale %f [%f %f^]"), mScaleXYZ + 0, mScaleXYZ + 1, mScaleXYZ + 2, kOptionScaleXYZ,
                 "Set uniform or xyz scale",
 
             "-counts <count1:int> ...", &mCounts,
@@ -121,22 +121,59 @@ struct cCommand
                 "Show full help, or help of the given type",
             0, 0
         );
+
+        mArgSpec.SetArraySeparators(" \t,");  // allow -countArray 1,2,3 as well as "1 2 3"
+    }
+
+    explicit cCommand(const cCommand* prototype)
+    // Share prototype's spec, bound to our members, rather than rebuilding it, e.g., when creating a command per request
+    {
+        mArgSpec.Clone(prototype->mArgSpec, prototype, this, sizeof(cCommand));
+    }
+
+    tArgSpecError LoadSpec(cArgSpec* spec, const vector<char>& data)
+    // Load a spec saved via SaveSpec(), binding it to our members, in the order ConstructSpec() was given them
+    {
+        void* bindings[] =
+        {
+            &mName, &mDestination, &mSize, &mGamma, &mEnableCats, &mLatitude, &mLongitude, &mJulianDay, &mColour,
+            &mV2[0], mV3, mV4, mScaleXYZ + 0, mScaleXYZ + 1, mScaleXYZ + 2,
+            &mCounts, &mCounts, &mWords, &mV3s, &mColours, &mHelpType
+        };
+
+        return spec->LoadSpec(data.data(), data.size(), bindings, int(sizeof(bindings) / sizeof(bindings[0])));
     }
 
-    void PrintVariables()
+    int PrintResults(const cArgSpec& spec)
+    // Print help if it was asked for, or otherwise the parsed values
     {
-        if (!mArgSpec.Flag(kOptionScaleXYZ))
+        if (spec.Flag(kOptionHelp))
+        {
+            string helpString;
+
+            spec.CreateHelpString("test", &helpString, mHelpType);
+            printf("%s\n", helpString.c_str());
+            return 0;
+        }
+
+        PrintVariables(spec);
+        return 0;
+    }
+
+    void PrintVariables(const cArgSpec& spec)
+    {
+        if (!spec.Flag(kOptionScaleXYZ))
             mScaleXYZ[1] = mScaleXYZ[2] = mScaleXYZ[0];
 
         printf("\nflags:\n");
 
-        if (mArgSpec.Flag(kOptionVerbose))
+        if (spec.Flag(kOptionVerbose))
             printf("verbose\n");
-        if (mArgSpec.Flag(kOptionHaveDest))
+        if (spec.Flag(kOptionHaveDest))
             printf("dest\n");
-        if (mArgSpec.Flag(kOptionSize))
+        if (spec.Flag(kOptionSize))
             printf("size\n");
-        if (mArgSpec.Flag(kOptionGamma))
+        if (spec.Flag(kOptionGamma))
             printf("gamma\n");
 
         printf("\nvalues:\n");
@@ -205,29 +242,208 @@ struct cCommand
 };
 
 
-int main(int argc, const char** argv)
+// Further features are shown via subcommands, whose specs are only constructed if selected, as run by
+// cFeatureCommands
+
+const int kNumFlags = 40;
+
+tArgSpecError ConstructFlags(void*, cArgSpec* spec)
+// Flags -f0 to -f39
 {
-    cCommand test;
+    tArgSpecError err = spec->ConstructSpec("Set any of 40 flags", nullptr);
+    char option[16];
 
-    tArgError err = test.mArgSpec.Parse(argc, argv);
+    for (int i = 0; i < kNumFlags && err == kSpecNoError; i++)
+    {
+        snprintf(option, sizeof(option), "-f%d^", i);
+        err = spec->AppendSpec(option, i, "Set flag", nullptr);
+    }
 
-    if (err != kArgNoError)
+    return err;
+}
+
+struct cSavedCommand
+{
+    const cCommand* mPrototype;
+    cCommand        mCommand;
+    vector<char>    mData;      // the prototype's saved spec, which the loaded one references
+
+    explicit cSavedCommand(const cCommand* prototype) : mPrototype(prototype), mCommand(prototype) {}
+};
+
+tArgSpecError ConstructSaved(void* userData, cArgSpec* spec)
+// The example spec, after a save and load round trip
+{
+    cSavedCommand* saved = (cSavedCommand*) userData;
+
+    saved->mPrototype->mArgSpec.SaveSpec(&saved->mData);
+    return saved->mCommand.LoadSpec(spec, saved->mData);
+}
+
+struct cMismatchCommand
+{
+    float           mCount = 0;     // wrongly typed for <count:int>
+    int             mDay = 0;
+};
+
+tArgSpecError ConstructMismatch(void* userData, cArgSpec* spec)
+// Binds a float to an <int> argument, which ConstructSpec() reports, and Parse() then refuses with kArgErrorBadSpec.
+// Wrapping each spec in AS_ARGS() would instead fail to compile.
+{
+    cMismatchCommand* mismatch = (cMismatchCommand*) userData;
+
+    spec->ConstructSpec
+    (
+        "Show type checking of bound variables",
+        "-count <count:int>", &mismatch->mCount,
+            "Set count, which is wrongly bound to a float",
+        "-day <day:int>", &mismatch->mDay,
+            "Set Julian day",
+        nullptr
+    );
+
+    return kSpecNoError;    // carry on regardless, to show Parse() failing
+}
+
+struct cDictionaryCommand
+{
+    int             mVariant = -1;
+};
+
+tArgSpecError ConstructDictionary(void* userData, cArgSpec* spec)
+// Reads the tokens of the <variant> enum from test-dict.txt, as created by 'make test'
+{
+    cDictionaryCommand* dictionary = (cDictionaryCommand*) userData;
+
+    return spec->ConstructSpec
+    (
+        "Select a variant from a dictionary enum",
+        "@variant", "test-dict.txt",
+        "-variant <variant>", &dictionary->mVariant,
+            "Select variant",
+        nullptr
+    );
+}
+
+struct cDefaultsCommand
+{
+    enum { kOptionFast };
+
+    int         mJobs = 1;
+    string      mName;
+    int         mSize[2] = {};
+
+    void Print(const cArgSpec& spec)
     {
-        printf("%s\n", test.mArgSpec.ErrorString());
-        return -1;
-    }    
+        printf("jobs: %d\nname: %s\nsize: %d x %d\nfast: %s\n", mJobs, mName.c_str(), mSize[0], mSize[1],
+            spec.Flag(kOptionFast) ? "yes" : "no");
+    }
+};
+
+tArgSpecError ConstructDefaults(void* userData, cArgSpec* spec)
+// Options can take defaults from the config file named by $AS_EXAMPLE_CONFIG, then the environment, and
+// lastly the command line
+{
+    cDefaultsCommand* defaults = (cDefaultsCommand*) userData;
+
+    spec->SetEnvironment(true);
+    spec->SetConfigFile(getenv("AS_EXAMPLE_CONFIG"));
+
+    return spec->ConstructSpec
+    (
+        "Take option defaults from a config file and the environment",
+        "-jobs $AS_EXAMPLE_JOBS <jobs:int>", &defaults->mJobs,
+            "Set number of jobs",
+        "-name $AS_EXAMPLE_NAME <name:string>", &defaults->mName,
+            "Set name, which may refer to other variables as ${VAR}",
+        "-size <width:int> <height:int>", &defaults->mSize[0], &defaults->mSize[1],
+            "Set size",
+        "-fast^ $AS_EXAMPLE_FAST", cDefaultsCommand::kOptionFast,
+            "Go faster",
+        nullptr
+    );
+}
+
+void PrintFlags(const cArgSpec& spec)
+{
+    printf("\nflags:");
+
+    for (int i = 0; i < kNumFlags; i++)
+        if (spec.Flag(i))
+            printf(" -f%d", i);
+
+    // Flags can also be tested en masse, e.g., to dispatch on any of a group
+    const uint64_t kHighFlags[] = { 0xFFull << 32 };    // -f32 to -f39
+
+    printf("\nany of -f32 to -f39: %s\n", spec.AnyFlags(kHighFlags, 1) ? "yes" : "no");
+}
+
+struct cFeatureCommands
+{
+    cArgSubcommands     mCommands;
+    cSavedCommand       mSaved;
+    cMismatchCommand    mMismatch;
+    cDictionaryCommand  mDictionary;
+    cDefaultsCommand    mDefaults;
+
+    explicit cFeatureCommands(const cCommand* prototype) :
+        mCommands("Further ArgSpec features"),
+        mSaved(prototype)
+    {
+        mCommands.Add("flags",    "Set any of 40 flags", ConstructFlags);
+        mCommands.Add("saved",    "Parse as usual, via a saved and reloaded spec", ConstructSaved, &mSaved);
+        mCommands.Add("mismatch", "Show type checking of bound variables", ConstructMismatch, &mMismatch);
+        mCommands.Add("dict",     "Select a variant from a dictionary enum", ConstructDictionary, &mDictionary);
+        mCommands.Add("defaults", "Take option defaults from a config file and the environment", ConstructDefaults, &mDefaults);
+    }
 
-    if (test.mArgSpec.Flag(test.kOptionHelp))
+    int Run(int argc, const char** argv)
     {
-        string helpString;
+        if (mCommands.Parse(argc, argv) != kArgNoError)
+        {
+            printf("%s\n", mCommands.ErrorString());
+            return -1;
+        }
+
+        int selected = mCommands.Selected();
+        const cArgSpec& spec = *mCommands.Spec(selected);
+
+        if (selected == mCommands.Find("flags"))
+            PrintFlags(spec);
+        else if (selected == mCommands.Find("saved"))
+            return mSaved.mCommand.PrintResults(spec);
+        else if (selected == mCommands.Find("dict"))
+            printf("variant: %d\n", mDictionary.mVariant);
+        else if (selected == mCommands.Find("defaults"))
+            mDefaults.Print(spec);
 
-        test.mArgSpec.CreateHelpString("test", &helpString, test.mHelpType);
-        printf("%s\n", helpString.c_str());
         return 0;
     }
+};
+
+
+int main(int argc, const char** argv)
+{
+    cCommand prototype;
+
+    if (prototype.mArgSpec.WriteCompletions(argc, argv))    // tab completion, as run by CreateCompletionScript()'s script
+        return 0;
+
+    cFeatureCommands features(&prototype);
+
+    if (argc > 1 && features.mCommands.Find(argv[1]) >= 0)
+        return features.Run(argc, argv);
+
+    cCommand test(&prototype);
+
+    tArgError err = test.mArgSpec.Parse(argc, argv);
 
-    test.PrintVariables();
+    if (err != kArgNoError)
+    {
+        printf("%s\n", test.mArgSpec.ErrorString());
+        return -1;
+    }    
 
-    return 0;
+    return test.PrintResults(test.mArgSpec);
 }
 